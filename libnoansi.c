@@ -0,0 +1,3068 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "noansi.h"
+
+/* noansi: rough translator from cp437+dosansi -> ascii+mirc colors
+ * cstone@pobox.com
+ *
+ * this is the translator itself; noansi.c is the command line front end and
+ * noansi.h the interface for anything else that wants to use it.
+ *
+ * build: cc -O2 -pthread -o noansi noansi.c libnoansi.c
+ *
+ * R.I.P. BANTOWN
+ *
+ * references used here: ctlseqs.ms (xorg source); ms-dos 6.22 help (ansi.sys);
+ * ecma-48; (http://www.ecma-international.org/publications/standards/Ecma-048.htm);
+ * NANSI source (4.0, earlier); various comp.terminals searches; dosbox
+ *
+ * (it should be noted that none of these perfectly explains why sequences like SGR 55
+ * or SGR 48 (esp. in constructions like in CSI 1 ; 48 m, which makes no sense
+ * and doesn't seem to do anything) end up in ansis from the early 1990s &
+ * intended for visual display only.  SGR 48, 53, 55 are always silently ignored.)
+ *
+ * also unknown: CSI 0x4b 0x4d
+ */
+#define NCOLS 80        /* default screen size */
+#define NROWS 1024
+#define MAXCOLS 4096
+#define MAXSEQLEN 64
+enum { 
+    /* mirc color codes; from http://www.mirc.co.uk/help/color.txt */
+        mWHITE = 0,   mBLACK = 1,   mBLUE = 2,   mGREEN = 3,
+        mRED = 4,     mBROWN = 5,   mPURPLE = 6, mORANGE = 7,
+        mYELLOW = 8,  mLTGREEN = 9, mTEAL = 10,  mCYAN = 11,
+        mLTBLUE = 12, mPINK = 13,   mGREY = 14,  mLTGREY = 15,
+
+    /* iso/ansi color pattern. +30 for fg, +40 for bg */
+        aBLACK = 0, aRED = 1,     aGREEN = 2, aYELLOW = 3,
+        aBLUE = 4,  aMAGENTA = 5, aCYAN = 6,  aWHITE = 7,
+
+    /* SGR flags (that we support here); see below */
+        ACF_BOLD =    0x10000, ACF_UNDERLINE =  0x20000,
+        ACF_BLINK =   0x40000, ACF_INVERSE =    0x80000,
+        ACF_BGBOLD = 0x100000, 
+        
+    /* special "unchanged" flag used in default_char */
+        ACF_UNCHANGED = 0x200000,
+};
+const int sgr_to_mirc[] = {
+    mBLACK,  mRED, mGREEN,   mYELLOW, mBLUE,   mPURPLE, mCYAN, mLTGREY,
+    mGREY,  mPINK, mLTGREEN, mYELLOW, mLTBLUE, mPINK,   mTEAL, mWHITE
+};
+
+/* bits 0-7 of achar_t are the character; bits 8-11 are the fg color; bits
+ * 12-15 are the bg color; the rest are flags
+ */
+typedef u_int32_t achar_t;
+#define AC(chr,fg,bg,flags) ((chr & 0xff) | ((fg & 0xf) << 8) | ((bg & 0xf) << 12) | (flags & 0xffff0000))
+#define ACCHAR(x) ((unsigned char)(x & 0xff))
+#define ACREST(x) (x & 0xffffff00)
+#define ACFG(x) ((x >> 8) & 0xf)
+#define ACBG(x) ((x >> 12) & 0xf)
+#define ACFLAGS(x) (x & 0xffff0000)
+
+#ifndef MAX
+#define MAX(x,y) ((x) > (y) ? (x) : (y))
+#endif
+#ifndef MIN
+#define MIN(x,y) ((x) > (y) ? (y) : (x))
+#endif
+
+static const unsigned int default_fg = aWHITE, default_bg = aBLACK;
+static const unsigned char default_ch = ' ';
+static const achar_t default_char = AC(' ', aWHITE, aBLACK, ACF_UNCHANGED);
+
+/* -1 if sgrcode isn't one we know, 1 if we know it and ignore it */
+static int handle_sgr(int sgrcode, unsigned int *curfg, unsigned int *curbg,
+        unsigned int *curflags) {
+    switch(sgrcode) {
+        case 0:
+            *curflags = 0;
+            *curfg = default_fg;
+            *curbg = default_bg;
+            break;
+        case 1:   /* bold */
+            *curflags = ACF_BOLD;
+            break;
+        case 4:   /* underlined */
+            *curflags = ACF_UNDERLINE;
+            break;
+        case 5:   /* blink */
+            *curflags = ACF_BLINK;
+            break;
+        case 7:   /* inverse */
+            *curflags = ACF_INVERSE;
+            break;
+        case 30: case 31: case 32: case 33:
+        case 34: case 35: case 36: case 37:
+            *curfg = sgrcode-30;
+            break;
+        case 39:   /* ctlseqs.ms: "Set foreground color to default (original)" */
+            *curfg = default_fg;
+            break;
+        case 40: case 41: case 42: case 43:
+        case 44: case 45: case 46: case 47:
+            *curbg = sgrcode-40;
+            break;
+
+        case 8:    /* invisible */
+        case 48:   /* i'm not sure what this is supposed to do.  ECMA-48
+                    * indicates that this is supposed to be used in cases such
+                    * as CSI [ 48 ; 5 ; Ps m, which is supposed to set the bg
+                    * color to Ps.  but this construction doesn't seem to
+                    * work:  Ps is treated as a normal SGR code.  ctlseqs.ms
+                    * says this is only for newer xterm/rxvts, anyway..
+                    */
+        case 53:   /* enable "overline mode" (an apparent misnomer in many cases) */
+        case 55:   /* disable overline mode */
+            return 1;
+        default:
+            return -1;
+    }
+    return 0;
+}
+/* the canvas.  rows are allocated the first time anything is written to them
+ * (CHUNKROWS at a time); a row that was never allocated is implicitly all
+ * default_char.  rows are kept across clears (and across files, in batch
+ * mode) and only the used part is wiped.  rows that aren't attached to the
+ * screen wait on the spare list, always wiped, until they're needed.
+ *
+ * the parser keeps two high-water marks as it writes: lens[x] is one past the
+ * last column written in row x, and used is one past the last row written.
+ * since a written cell can never equal default_char, those are exactly the
+ * ends of the row and of the screen once trailing blanks are dropped.  a row
+ * is also marked dirty whenever it's written or cleared, for animations.
+ *
+ * erasing is lazy where it can be.  cutting a row short (a clear, or an
+ * erase to the end of the row) only lowers lens and raises stale, which says
+ * how far the row may still hold old cells; those are wiped when something
+ * is next written beyond lens, or the row goes back on the spare list.  so
+ * a clear is one store per row, and a row that isn't written again is never
+ * wiped at all.  an erase that leaves something after it fills the span
+ * with fill_blank().
+ */
+#define CHUNKROWS 32
+struct screen {
+    achar_t **rows;             /* nslots; NULL until the row is first written */
+    unsigned int *lens;         /* nslots */
+    unsigned int *stale;        /* nslots; old cells may be left up to here */
+    unsigned char *dirty;       /* nslots; changed since the last animation frame */
+    unsigned int nslots;
+    achar_t **spare;            /* rows allocated but not in use */
+    unsigned int nspare;
+    achar_t **chunks;           /* every allocation, for screen_free() */
+    unsigned int nchunks;
+    unsigned int nrows, ncols;  /* canvas size; the cursor is clamped to it */
+    unsigned int used;
+    unsigned long touched;      /* rows that went from empty to written, for stats */
+};
+static void screen_init(struct screen *s, unsigned int nrows, unsigned int ncols) {
+    memset(s, 0, sizeof(*s));
+    s->nrows = nrows;
+    s->ncols = ncols;
+}
+static void screen_free(struct screen *s) {
+    unsigned int i;
+    for(i = 0; i < s->nchunks; i++) {
+        free(s->chunks[i]);
+    }
+    free(s->chunks);
+    free(s->rows);
+    free(s->lens);
+    free(s->stale);
+    free(s->dirty);
+    free(s->spare);
+    screen_init(s, s->nrows, s->ncols);
+}
+/* set n cells to default_char: one store, then copies of what's done so far,
+ * doubling, so a span of any length is a handful of memcpy()s
+ */
+static void fill_blank(achar_t *p, unsigned int n) {
+    unsigned int k;
+    if(n == 0) {
+        return;
+    }
+    p[0] = default_char;
+    for(k = 1; k < n; k *= 2) {
+        memcpy(p + k, p, MIN(k, n - k) * sizeof(achar_t));
+    }
+}
+/* a new width means new chunks; a new height just moves the clamp */
+static void screen_fit(struct screen *s, unsigned int nrows, unsigned int ncols) {
+    if(ncols != s->ncols) {
+        screen_free(s);
+        screen_init(s, nrows, ncols);
+    }
+    s->nrows = nrows;
+}
+/* row x for reading, or NULL if it's never been written */
+static achar_t *screen_peek(struct screen const *s, unsigned int x) {
+    return x < s->nslots ? s->rows[x] : NULL;
+}
+/* put CHUNKROWS more rows on the spare list; -1 if out of memory */
+static int screen_alloc(struct screen *s) {
+    achar_t **nc, **ns, *chunk;
+    unsigned int i;
+    if((nc = realloc(s->chunks, (s->nchunks + 1) * sizeof(achar_t *))) == NULL) {
+        return -1;
+    }
+    s->chunks = nc;
+    if((ns = realloc(s->spare, (s->nchunks + 1) * CHUNKROWS * sizeof(achar_t *))) == NULL) {
+        return -1;
+    }
+    s->spare = ns;
+    if((chunk = malloc(sizeof(achar_t) * CHUNKROWS * s->ncols)) == NULL) {
+        return -1;
+    }
+    fill_blank(chunk, CHUNKROWS * s->ncols);
+    s->chunks[s->nchunks++] = chunk;
+    for(i = 0; i < CHUNKROWS; i++) {
+        s->spare[s->nspare++] = chunk + i * s->ncols;
+    }
+    return 0;
+}
+/* make room for n rows in the slots; -1 if out of memory */
+static int screen_slots(struct screen *s, unsigned int n) {
+    achar_t **nr;
+    unsigned int *nl, *nt, i;
+    unsigned char *nd;
+    if(n <= s->nslots) {
+        return 0;
+    }
+    if((nr = realloc(s->rows, n * sizeof(achar_t *))) == NULL) {
+        return -1;
+    }
+    s->rows = nr;
+    if((nl = realloc(s->lens, n * sizeof(unsigned int))) == NULL) {
+        return -1;
+    }
+    s->lens = nl;
+    if((nt = realloc(s->stale, n * sizeof(unsigned int))) == NULL) {
+        return -1;
+    }
+    s->stale = nt;
+    if((nd = realloc(s->dirty, n)) == NULL) {
+        return -1;
+    }
+    s->dirty = nd;
+    for(i = s->nslots; i < n; i++) {
+        nr[i] = NULL;
+        nl[i] = 0;
+        nt[i] = 0;
+        nd[i] = 0;
+    }
+    s->nslots = n;
+    return 0;
+}
+/* allocate n rows up front, when the size of the picture is known; -1 if
+ * out of memory
+ */
+static int screen_reserve(struct screen *s, unsigned int n) {
+    if(screen_slots(s, n) < 0) {
+        return -1;
+    }
+    while(s->nchunks * CHUNKROWS < n) {
+        if(screen_alloc(s) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+/* row x for writing, attaching a spare row if need be; NULL if out of memory */
+static achar_t *screen_row(struct screen *s, unsigned int x) {
+    if(x >= s->nslots && screen_slots(s, MAX(x + 1, s->nslots * 2)) < 0) {
+        return NULL;
+    }
+    if(s->rows[x] == NULL) {
+        if(s->nspare == 0 && screen_alloc(s) < 0) {
+            return NULL;
+        }
+        s->rows[x] = s->spare[--s->nspare];
+    }
+    if(x >= s->used) {
+        s->used = x + 1;
+    }
+    return s->rows[x];
+}
+/* store one cell; -1 if out of memory */
+static int screen_put(struct screen *s, unsigned int x, unsigned int y, achar_t c) {
+    achar_t *row = screen_row(s, x);
+    if(row == NULL) {
+        return -1;
+    }
+    row[y] = c;
+    if(y >= s->lens[x]) {
+        s->touched += s->lens[x] == 0;
+        if(__builtin_expect(s->stale[x] > s->lens[x], 0)) {
+            /* old cells between the end and here */
+            fill_blank(row + s->lens[x], MIN(y, s->stale[x]) - s->lens[x]);
+            if(y + 1 >= s->stale[x]) {
+                s->stale[x] = 0;
+            }
+        }
+        s->lens[x] = y + 1;
+    }
+    s->dirty[x] = 1;
+    return 0;
+}
+/* erase columns [from, to) of row x */
+static void screen_erase(struct screen *s, unsigned int x, unsigned int from,
+        unsigned int to) {
+    achar_t *row = screen_peek(s, x);
+    if(row == NULL || from >= s->lens[x] || from >= to) {
+        return;
+    }
+    if(to >= s->lens[x]) {
+        s->stale[x] = MAX(s->stale[x], s->lens[x]);
+        s->lens[x] = from;
+        /* what's left may end in blanks an earlier erase filled in */
+        while(s->lens[x] > 0 && row[s->lens[x] - 1] == default_char) {
+            s->lens[x]--;
+        }
+    } else {
+        fill_blank(row + from, to - from);
+    }
+    s->dirty[x] = 1;
+}
+/* erase rows [from, to) whole */
+/* the screen ends at its last row with anything on it: after erasing in
+ * a row, it may not any more
+ */
+static void screen_trim(struct screen *s) {
+    while(s->used > 0 && s->lens[s->used - 1] == 0) {
+        s->used--;
+    }
+}
+static void screen_erase_rows(struct screen *s, unsigned int from, unsigned int to) {
+    unsigned int i;
+    for(i = from; i < MIN(to, s->used); i++) {
+        if(s->lens[i] > 0) {
+            s->stale[i] = MAX(s->stale[i], s->lens[i]);
+            s->lens[i] = 0;
+            s->dirty[i] = 1;
+        }
+    }
+    screen_trim(s);
+}
+static void clear_screen(struct screen *s) {
+    screen_erase_rows(s, 0, s->used);
+}
+/* remove the top n rows; everything below moves up n */
+static void screen_drop(struct screen *s, unsigned int n) {
+    unsigned int i;
+    n = MIN(n, s->nslots);
+    if(n == 0) {
+        return;
+    }
+    for(i = 0; i < n; i++) {
+        achar_t *row = s->rows[i];
+        if(row != NULL) {
+            fill_blank(row, MAX(s->lens[i], s->stale[i]));
+            s->spare[s->nspare++] = row;
+        }
+    }
+    memmove(s->rows, s->rows + n, (s->nslots - n) * sizeof(achar_t *));
+    memmove(s->lens, s->lens + n, (s->nslots - n) * sizeof(unsigned int));
+    memmove(s->stale, s->stale + n, (s->nslots - n) * sizeof(unsigned int));
+    memmove(s->dirty, s->dirty + n, s->nslots - n);
+    for(i = s->nslots - n; i < s->nslots; i++) {
+        s->rows[i] = NULL;
+        s->lens[i] = 0;
+        s->stale[i] = 0;
+        s->dirty[i] = 0;
+    }
+    s->used = s->used > n ? s->used - n : 0;
+}
+
+/* everything the parser knows between one piece of input and the next.  for
+ * a plain conversion that's the whole file at once, but a stream is fed in
+ * pieces that can split a sequence anywhere.
+ */
+struct parser {
+    unsigned int state;
+    unsigned int x, y;                  /* cursor row, column */
+    unsigned int savedx, savedy, saved;
+    /* since the parser was last started from a given state (a segment, see
+     * render_segments()): whether it saved, and whether it restored, or
+     * tried to, a position from before that
+     */
+    unsigned int savedhere, lookedback;
+    unsigned int curfg, curbg, curflags, wrapping;
+    /* a sequence can't hold more than MAXSEQLEN bytes, so params never
+     * needs to be any bigger; nothing is read past params[np-1].
+     */
+    int params[MAXSEQLEN], np, num, ndigits, quesflag, semicount;
+    unsigned int curseqlen;
+    long pos;                           /* input offset of the current piece */
+};
+
+/* streaming state.  rows of the screen above the window, and above the
+ * cursor and any saved position, are printed and dropped as the cursor
+ * moves on; top counts how many have gone, so that screen row x is line
+ * top+x of the output.
+ */
+#define STREAMROWS (UINT_MAX / 2)
+struct stream {
+    int on;
+    unsigned int top;
+    unsigned int pending;   /* blank lines dropped after the last printed one */
+    int printed;            /* anything printed at all */
+    struct noansi_buf *out;
+};
+
+/* animation state: per row of the screen, a hash of how it looked in the
+ * last frame, so that rows that were written but came out the same anyway
+ * aren't printed again
+ */
+struct anim {
+    int on;
+    unsigned long frames;
+    u_int64_t *prev;
+    unsigned int nprev;
+    struct noansi_buf row;  /* scratch */
+    struct noansi_buf *out;
+};
+
+/* what a conversion counts as it goes, for noansi_skipped() and
+ * noansi_stats().  it's kept apart from the rest of the stats because it
+ * adds up: the segments of a parallel parse each count their own.
+ */
+struct counts {
+    unsigned long skips[NOANSI_NSKIPS];  /* what lenient mode let go, by kind */
+    unsigned long cells, seqs[NOANSI_NFINALS], sgr, sgr_ignored, sgr_invalid;
+    unsigned long rows, maxrow, clamps, colorbytes;
+};
+static void counts_add(struct counts *to, struct counts const *c) {
+    unsigned int i;
+    for(i = 0; i < NOANSI_NSKIPS; i++) {
+        to->skips[i] += c->skips[i];
+    }
+    for(i = 0; i < NOANSI_NFINALS; i++) {
+        to->seqs[i] += c->seqs[i];
+    }
+    to->cells += c->cells;
+    to->sgr += c->sgr;
+    to->sgr_ignored += c->sgr_ignored;
+    to->sgr_invalid += c->sgr_invalid;
+    to->rows += c->rows;
+    to->maxrow = MAX(to->maxrow, c->maxrow);
+    to->clamps += c->clamps;
+    to->colorbytes += c->colorbytes;
+}
+
+struct noansi_ctx {
+    struct noansi_options opts;
+    struct screen screen;
+    struct parser ps;
+    struct stream st;
+    struct anim an;
+    struct noansi_cache *cache;     /* shared, not ours; may be NULL */
+    struct counts counts;
+    struct noansi_stats stats;      /* the rest: bytes, cache hit, times */
+    char errmsg[256];
+};
+static int stream_page(struct noansi_ctx *ctx);
+static int anim_frame(struct noansi_ctx *ctx, long pos);
+
+/* record an error for the conversion in progress in ctx; returns
+ * NOANSI_ESYNTAX, so callers can bail out with return doerror(...).
+ */
+static int doerror(struct noansi_ctx *ctx, char const *fmt, ...) {
+    va_list va;
+    va_start(va, fmt);
+    vsnprintf(ctx->errmsg, sizeof(ctx->errmsg), fmt, va);
+    va_end(va);
+    return NOANSI_ESYNTAX;
+}
+/* a sequence we can't handle.  strict, that's the end of the conversion;
+ * lenient, it's counted and parsing goes on in state then.  a CSI sequence
+ * is dropped whole: the rest of it, if the byte it went wrong on didn't end
+ * it, is ignored up to the byte that does.  only for use in read_ansi().
+ */
+#define ISFINAL(c) ((c) >= 0x40 && (c) <= 0x7e)
+#define ISDIGIT(c) ((unsigned char)((c) - '0') < 10)
+#define SKIPREST(c) (ISFINAL(c) ? S_GROUND : S_IGNORE)
+#define BADSEQ(kind, then, ...) do {                \
+        if(!lenient) {                              \
+            rc = doerror(ctx, __VA_ARGS__);         \
+            goto stop;                              \
+        }                                           \
+        ctx->counts.skips[kind]++;                  \
+        state = (then);                             \
+        goto next;                                  \
+    } while(0)
+static int nomem(struct noansi_ctx *ctx) {
+    snprintf(ctx->errmsg, sizeof(ctx->errmsg), "out of memory\n");
+    return NOANSI_ENOMEM;
+}
+
+/* timing the stages of a conversion, with opts.stats; without, these do
+ * nothing.  cpu time is this thread's: worker threads add their own.
+ */
+struct stopwatch {
+    struct timespec wall, cpu;
+};
+static double elapsed(struct timespec const *since, clockid_t clock) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (now.tv_sec - since->tv_sec) + (now.tv_nsec - since->tv_nsec) / 1e9;
+}
+static void watch_start(struct noansi_ctx const *ctx, struct stopwatch *w) {
+    if(ctx->opts.stats) {
+        clock_gettime(CLOCK_MONOTONIC, &w->wall);
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &w->cpu);
+    }
+}
+static void watch_stop(struct noansi_ctx *ctx, struct stopwatch const *w, int stage) {
+    if(ctx->opts.stats) {
+        ctx->stats.wall[stage] += elapsed(&w->wall, CLOCK_MONOTONIC);
+        ctx->stats.cpu[stage] += elapsed(&w->cpu, CLOCK_THREAD_CPUTIME_ID);
+    }
+}
+
+/* the parser is a small ecma-48 style state machine: ground (printing),
+ * escape (just saw ESC) and csi (collecting parameters up to a final byte),
+ * plus stop, after a ^Z, and ignore, skipping the rest of a bad sequence.
+ * every byte is looked up once in byte_class, which holds its meaning in the
+ * ground state in the low nibble and inside a CSI in the high nibble, so
+ * printing a plain character costs one lookup and one store.
+ *
+ * intermediate bytes (0x20-0x2f) and the other private parameter bytes are
+ * classed K_BAD, as nothing we understand uses them.
+ */
+enum { S_GROUND, S_ESCAPE, S_CSI, S_STOP, S_IGNORE };
+enum {
+    /* ground */
+        G_PRINT = 0, G_TAB, G_LF, G_CR, G_SUB, G_ESC,
+    /* csi */
+        K_BAD = 0, K_DIGIT, K_SEMI, K_QUES, K_SUB,
+        K_SGR, K_ED, K_SM, K_CUP, K_SCP, K_RCP, K_CUR, K_EL, K_CHA, K_VPA,
+};
+#define GCLASS(c) (byte_class[c] & 0xf)
+#define KCLASS(c) (byte_class[c] >> 4)
+static const unsigned char byte_class[256] = {
+    [0x09] = G_TAB, [0x0a] = G_LF, [0x0d] = G_CR,
+    [0x1a] = G_SUB | K_SUB << 4,
+    [0x1b] = G_ESC,
+    ['0'] = K_DIGIT << 4, ['1'] = K_DIGIT << 4, ['2'] = K_DIGIT << 4,
+    ['3'] = K_DIGIT << 4, ['4'] = K_DIGIT << 4, ['5'] = K_DIGIT << 4,
+    ['6'] = K_DIGIT << 4, ['7'] = K_DIGIT << 4, ['8'] = K_DIGIT << 4,
+    ['9'] = K_DIGIT << 4,
+    [';'] = K_SEMI << 4, ['?'] = K_QUES << 4,
+    ['m'] = K_SGR << 4, ['J'] = K_ED << 4,  ['h'] = K_SM << 4,
+    ['H'] = K_CUP << 4, ['f'] = K_CUP << 4,
+    ['s'] = K_SCP << 4, ['u'] = K_RCP << 4,
+    ['A'] = K_CUR << 4, ['B'] = K_CUR << 4, ['C'] = K_CUR << 4,
+    ['D'] = K_CUR << 4,
+    ['K'] = K_EL << 4,  ['G'] = K_CHA << 4, ['d'] = K_VPA << 4,
+};
+static void parser_reset(struct parser *ps) {
+    memset(ps, 0, sizeof(*ps));
+    ps->state = S_GROUND;
+    ps->curfg = aWHITE;
+    ps->curbg = aBLACK;
+    ps->wrapping = 1;
+}
+/* parse the next piece of input, picking up where the last one left off.
+ * the hot state is kept in locals and written back to ctx->ps at the end,
+ * or where it failed.  so are the counts the parser keeps on every byte;
+ * the rest go straight to ctx->counts.
+ */
+static int read_ansi(struct noansi_ctx *ctx, unsigned char const *buf, size_t len) {
+    struct screen *screen = &ctx->screen;
+    struct parser *ps = &ctx->ps;
+    int const expandtab = ctx->opts.expandtab, includez = ctx->opts.includez,
+          lenient = ctx->opts.lenient;
+    unsigned char const *p = buf, *end = buf + len;
+    unsigned int delta;
+    unsigned int x = ps->x, y = ps->y, state = ps->state;
+    unsigned int savedx = ps->savedx, savedy = ps->savedy, saved = ps->saved;
+    unsigned int const nrows = screen->nrows, ncols = screen->ncols;
+    unsigned int curbg = ps->curbg, curfg = ps->curfg, curflags = ps->curflags,
+                 wrapping = ps->wrapping;
+    /* lastrow is the bottom of the canvas.  a stream has none: it scrolls
+     * on for as long as there's input, and only the rows above the screen
+     * (top of them) are gone
+     */
+    unsigned int top = ctx->st.top, lastrow = ctx->st.on ? STREAMROWS : nrows - 1;
+    int *params = ps->params, np = ps->np, num = ps->num, ndigits = ps->ndigits, i,
+        quesflag = ps->quesflag, semicount = ps->semicount;
+    unsigned int curseqlen = ps->curseqlen;
+    long const pos = ps->pos;
+    unsigned long cells = 0, maxrow = ctx->counts.maxrow;
+    int rc = NOANSI_OK;
+    if(state == S_STOP) {
+        return NOANSI_OK;
+    }
+    while(p < end) {
+        unsigned int c = *p++, cls;
+        if(state == S_GROUND) {
+            cls = GCLASS(c);
+            if(cls == G_TAB && expandtab == 0) {
+                cls = G_PRINT;
+            } else if(cls == G_SUB && includez == 1) {
+                cls = G_PRINT;
+            }
+            switch(cls) {
+                case G_PRINT:
+                    if(screen_put(screen, x, y, AC(c, curfg, curbg, curflags)) < 0) {
+                        rc = nomem(ctx);
+                        goto stop;
+                    }
+                    cells++;
+                    /* last-line wrapping behavior may need to change */
+                    if(wrapping) {
+                        if(++y == ncols) {
+                            y = 0;
+                            if(x < lastrow) {
+                                x++;
+                            } else {
+                                ctx->counts.clamps++;
+                            }
+                            maxrow = MAX(maxrow, top + x);
+                        }
+                    } else {
+                        y = MIN(ncols-1,(y+1));
+                    }
+                    break;
+                case G_LF:
+                    if(x < lastrow) {
+                        x++;
+                    } else {
+                        ctx->counts.clamps++;
+                    }
+                    maxrow = MAX(maxrow, top + x);
+                    y = 0;
+                    break;
+                case G_CR:
+                    y = 0;
+                    break;
+                case G_TAB:
+                    y = MIN(ncols-1, ((y + 8) & ~7u));
+                    break;
+                case G_SUB:
+                    state = S_STOP;
+                    goto stop;
+                case G_ESC:
+                    state = S_ESCAPE;
+                    break;
+            }
+            continue;
+        }
+        if(state == S_ESCAPE) {
+            if(c != '[') {
+                BADSEQ(NOANSI_SKIP_ESCAPE, S_GROUND,
+                        "unknown sequence EOF 0x%d at pos %ld, aborting\n",
+                        c, pos+(long)(p-buf-1));
+            }
+            state = S_CSI;
+            np = num = ndigits = quesflag = semicount = 0;
+            curseqlen = 0;
+            continue;
+        }
+        if(state == S_IGNORE) {
+            if(c == 0x1a && includez == 0) {
+                state = S_STOP;
+                goto stop;
+            }
+            if(ISFINAL(c)) {
+                state = S_GROUND;
+            }
+            continue;
+        }
+
+        /* S_CSI */
+        curseqlen++;
+        if(curseqlen == MAXSEQLEN) {
+            BADSEQ(NOANSI_SKIP_LENGTH, SKIPREST(c),
+                    "reached max sequence length %u at position %ld, aborting\n",
+                    curseqlen, pos+(long)(p-buf-1));
+        }
+        cls = KCLASS(c);
+        if(cls == K_SUB) {
+            if(includez == 0) {
+                state = S_STOP;
+                goto stop;
+            }
+            cls = K_BAD;
+        }
+        if(cls == K_DIGIT) {
+            if(ndigits == 4) {
+                BADSEQ(NOANSI_SKIP_NUMBER, S_IGNORE,
+                        "error at pos %ld: number too large, aborting\n", pos+(long)(p-buf-1));
+            }
+            num = num * 10 + (c - '0');
+            ndigits++;
+            continue;
+        }
+        if(ndigits > 0) {
+            params[np++] = num;
+            num = ndigits = 0;
+        }
+        if(ISFINAL(c)) {
+            ctx->counts.seqs[c - 0x40]++;
+        }
+        switch(cls) {
+            case K_QUES:
+                if(np != 0) {
+                    BADSEQ(NOANSI_SKIP_FORM, SKIPREST(c),
+                            "invalid sequence CSI ... ; ? at pos %ld\n",
+                            pos+(long)(p-buf-1));
+                }
+                quesflag = 1;
+                continue;
+            case K_SEMI:
+                semicount++;
+                continue;
+            case K_SGR:     /* set graphics (SGR) attributes */
+                if(quesflag) {
+                    BADSEQ(NOANSI_SKIP_FORM, SKIPREST(c),
+                            "invalid CSI ? ... m at pos %ld\n",
+                            pos+(long)(p-buf-1));
+                }
+                if(np == 0) {
+                    handle_sgr(0, &curfg, &curbg, &curflags);
+                    ctx->counts.sgr++;
+                } else {
+                    for(i = 0; i < np; i++) {
+                        int r = handle_sgr(params[i], &curfg, &curbg, &curflags);
+                        if(r > 0) {
+                            ctx->counts.sgr_ignored++;
+                        } else if(r < 0) {
+                            ctx->counts.sgr_invalid++;
+                            ctx->counts.skips[NOANSI_SKIP_SGR]++;
+                        }
+                    }
+                    ctx->counts.sgr += np;
+                }
+                break;
+            case K_ED:      /* erase in display: 0 below the cursor, 1 above, 2 all, 3 scrollback */
+                if(quesflag) {
+                    BADSEQ(NOANSI_SKIP_FORM, SKIPREST(c),
+                            "invalid CSI ? ... J at pos %ld\n",
+                            pos+(long)(p-buf-1));
+                }
+                if(np > 1) {
+                    BADSEQ(NOANSI_SKIP_FORM, SKIPREST(c),
+                            "expected 0-1 params for CSI ... J, got %d\n",
+                            np);
+                }
+                if(np == 1 && params[0] > 3) {
+                    BADSEQ(NOANSI_SKIP_FORM, SKIPREST(c),
+                            "unknown parameter p = %d for CSI p J\n", params[0]);
+                }
+                if(np == 0 || params[0] == 0) {
+                    screen_erase(screen, x, y, ncols);
+                    screen_erase_rows(screen, x + 1, screen->used);
+                    break;
+                }
+                if(params[0] == 3) {
+                    /* the scrollback, which there isn't */
+                    break;
+                }
+                if(params[0] == 1) {
+                    screen_erase_rows(screen, 0, x);
+                    screen_erase(screen, x, 0, y + 1);
+                    screen_trim(screen);
+                    break;
+                }
+                if(ctx->st.on) {
+                    /* the old page is final now */
+                    ps->x = x;
+                    if(stream_page(ctx) != NOANSI_OK) {
+                        rc = NOANSI_ENOMEM;
+                        goto stop;
+                    }
+                    top = 0;
+                }
+                if(ctx->an.on && anim_frame(ctx, pos+(long)(p-buf-1)) != NOANSI_OK) {
+                    rc = NOANSI_ENOMEM;
+                    goto stop;
+                }
+                clear_screen(screen);
+                x = 0;
+                y = 0;
+                break;
+            case K_SM:      /* only handling CSI ? 7 h (enable wrapping) */
+                if(quesflag) {
+                    if(np != 1 || params[0] != 7) {
+                        BADSEQ(NOANSI_SKIP_FORM, SKIPREST(c),
+                                "expected CSI ? 7 h at position %ld\n",
+                                pos+(long)(p-buf-1));
+                    }
+                    wrapping = 1;
+                } else {
+                    BADSEQ(NOANSI_SKIP_FORM, SKIPREST(c),
+                            "unknown sequence: CSI %d %d %d h at position %ld\n",
+                            np > 0 ? params[0] : -1, np > 1 ? params[1] : -1,
+                            np > 2 ? params[2] : -1, pos+(long)(p-buf-1));
+                }
+                break;
+            case K_CUP:     /* CUP (CSI row ; col H), HVP (... f): set position */
+                if(quesflag) {
+                    BADSEQ(NOANSI_SKIP_FORM, SKIPREST(c),
+                            "invalid CSI ? ... H at pos %ld\n",
+                            pos+(long)(p-buf-1));
+                }
+                /* rows that have already been streamed out can't be
+                 * reached again; those go to the top of the screen instead
+                 */
+                if(((np == 1 && semicount == 0) || np == 2) && params[0] > (int)nrows) {
+                    ctx->counts.clamps++;
+                }
+                if(np == 0) {
+                    x = y = 0;
+                } else if(np == 1) {
+                    if(semicount == 0) {
+                        x = MAX(0, MIN(params[0]-1, (int)nrows-1) - (int)top);
+                        y = 0;
+                    } else {
+                        x = 0;
+                        y = MAX(0, MIN(params[0]-1, (int)ncols-1));
+                    }
+                } else if(np == 2) {
+                    x = MAX(0, MIN(params[0]-1, (int)nrows-1) - (int)top);
+                    y = MAX(0, MIN(params[1]-1, (int)ncols-1));
+                }
+                /* going home starts a redraw, so what's there is a frame */
+                if(ctx->an.on && x == 0 && y == 0
+                        && anim_frame(ctx, pos+(long)(p-buf-1)) != NOANSI_OK) {
+                    rc = NOANSI_ENOMEM;
+                    goto stop;
+                }
+                break;
+            case K_SCP:     /* save cursor position */
+                if(quesflag || np != 0) {
+                    BADSEQ(NOANSI_SKIP_FORM, SKIPREST(c),
+                            "invalid CSI s form at pos %ld\n",
+                            pos+(long)(p-buf-1));
+                }
+                savedx = x;
+                savedy = y;
+                saved = 1;
+                ps->savedhere = 1;
+                break;
+            case K_RCP:     /* restore cursor position */
+                if(quesflag || np != 0) {
+                    BADSEQ(NOANSI_SKIP_FORM, SKIPREST(c),
+                            "invalid CSI s form at pos %ld\n",
+                            pos+(long)(p-buf-1));
+                }
+                ps->lookedback |= !ps->savedhere;
+                if(!saved) {
+                    BADSEQ(NOANSI_SKIP_RESTORE, S_GROUND,
+                            "CSI u before a CSI s at pos %ld\n",
+                            pos+(long)(p-buf-1));
+                }
+                x = savedx;
+                y = savedy;
+                break;
+            case K_EL:      /* erase in line: 0 to the end, 1 to the cursor, 2 all */
+                if(quesflag || np > 1 || (np == 1 && params[0] > 2)) {
+                    BADSEQ(NOANSI_SKIP_FORM, SKIPREST(c),
+                            "invalid CSI ... K at pos %ld\n",
+                            pos+(long)(p-buf-1));
+                }
+                if(np == 0 || params[0] == 0) {
+                    screen_erase(screen, x, y, ncols);
+                } else {
+                    screen_erase(screen, x, 0, params[0] == 1 ? y + 1 : ncols);
+                }
+                screen_trim(screen);
+                break;
+            case K_CHA:     /* CHA (CSI col G): set column */
+            case K_VPA:     /* VPA (CSI row d): set row */
+                if(quesflag || np > 1) {
+                    BADSEQ(NOANSI_SKIP_FORM, SKIPREST(c),
+                            "invalid CSI ... %c at pos %ld\n",
+                            c, pos+(long)(p-buf-1));
+                }
+                i = np == 1 ? params[0] : 1;
+                if(cls == K_CHA) {
+                    y = MAX(0, MIN(i-1, (int)ncols-1));
+                } else {
+                    ctx->counts.clamps += i > (int)nrows;
+                    x = MAX(0, MIN(i-1, (int)nrows-1) - (int)top);
+                }
+                break;
+            case K_CUR:
+                /* move up/down <p> rows, forward/back <p> columns */
+                if(quesflag) {
+                    BADSEQ(NOANSI_SKIP_FORM, SKIPREST(c),
+                            "invalid CSI ? ... %c at pos %ld\n",
+                            c, pos+(long)(p-buf-1));
+                }
+                if(np > 1) {
+                    BADSEQ(NOANSI_SKIP_FORM, SKIPREST(c),
+                            "expected 0-1 parameters, got %d for CSI ... %c at pos %ld\n",
+                            np, c, pos+(long)(p-buf-1));
+                }
+                delta = np == 1 ? params[0] : 1;
+                if(c == 'A') {
+                    x = delta > x ? 0 : x - delta;
+                } else if(c == 'B') {
+                    ctx->counts.clamps += x + delta > lastrow;
+                    x = MIN(lastrow, (x+delta));
+                } else if(c == 'C') {
+                    y = MIN(ncols-1, (y+delta));
+                } else {
+                    y = delta > y ? 0 : y - delta;
+                }
+                break;
+            default:
+                BADSEQ(NOANSI_SKIP_UNKNOWN, SKIPREST(c),
+                        "unknown sequence CSI <params> 0x%x at pos %ld, aborting\n",
+                        c, pos+(long)(p-buf-1));
+        }
+        state = S_GROUND;
+        maxrow = MAX(maxrow, top + x);
+next:
+        ;
+    }
+stop:
+    ctx->counts.cells += cells;
+    ctx->counts.maxrow = maxrow;
+    ctx->counts.rows += screen->touched;
+    screen->touched = 0;
+    ps->state = state;
+    ps->x = x;
+    ps->y = y;
+    ps->savedx = savedx;
+    ps->savedy = savedy;
+    ps->saved = saved;
+    ps->curfg = curfg;
+    ps->curbg = curbg;
+    ps->curflags = curflags;
+    ps->wrapping = wrapping;
+    ps->np = np;
+    ps->num = num;
+    ps->ndigits = ndigits;
+    ps->quesflag = quesflag;
+    ps->semicount = semicount;
+    ps->curseqlen = curseqlen;
+    ps->pos = pos + len;
+    return rc;
+}
+/* the input is over */
+static int read_ansi_end(struct noansi_ctx *ctx) {
+    if(ctx->ps.state == S_ESCAPE) {
+        if(!ctx->opts.lenient) {
+            return doerror(ctx, "EOF reached after ESC, aborting\n");
+        }
+        ctx->counts.skips[NOANSI_SKIP_EOF]++;
+    }
+    return NOANSI_OK;
+}
+/* opts.preview: whether the rest of the input, in[0..len), can still matter
+ * to lines start to end.  the parser is in the ground state with the cursor
+ * and any saved position at or below line end.  only sequences move the
+ * cursor up, so the rest is run through a quick scan of them that keeps
+ * the row the cursor can at most have gone back up to.  the scan is
+ * conservative: anything it doesn't know, and anything that would be
+ * skipped or fail, stops it too.  returns where it stopped, or len if it got
+ * to the end, with *writes set if the rest puts anything on the screen.
+ * with keep (line end - 1 has something on it) nothing below the window
+ * matters; without it, how many lines are printed depends on the last one
+ * with anything on it, so erasing below stops the scan as well.  the input
+ * ends at any ^Z the parser would stop at.
+ */
+static size_t preview_scan(struct noansi_ctx const *ctx, unsigned char const *in,
+        size_t len, int keep, int *writes) {
+    struct parser const *ps = &ctx->ps;
+    int const expandtab = ctx->opts.expandtab;
+    unsigned int const end = ctx->opts.end, nrows = ctx->screen.nrows;
+    unsigned char const *p = in, *stop = in + len, *seq;
+    unsigned int low = ps->x, savedlow = ps->savedx, saved = ps->saved;
+    int params[MAXSEQLEN], np, num, ndigits, quesflag, semicount, p0;
+    *writes = 0;
+    while(p < stop) {
+        if((seq = memchr(p, 0x1b, stop - p)) == NULL) {
+            seq = stop;
+        }
+        for(; p < seq && !*writes; p++) {
+            *writes = *p != '\n' && *p != '\r' && (*p != '\t' || !expandtab);
+        }
+        if(seq == stop) {
+            break;
+        }
+        p = seq + 1;
+        if(p == stop || *p++ != '[') {
+            return seq - in;
+        }
+        np = num = ndigits = quesflag = semicount = 0;
+        for(; p < stop && p - seq - 1 < MAXSEQLEN
+                && (ISDIGIT(*p) || *p == ';' || *p == '?'); p++) {
+            if(ISDIGIT(*p)) {
+                if(ndigits == 4) {
+                    return seq - in;
+                }
+                num = num * 10 + (*p - '0');
+                ndigits++;
+                continue;
+            }
+            if(ndigits > 0) {
+                params[np++] = num;
+                num = ndigits = 0;
+            }
+            if(*p == ';') {
+                semicount++;
+            } else if(np != 0) {
+                return seq - in;
+            } else {
+                quesflag = 1;
+            }
+        }
+        /* the final byte, which must be in the sequence's first MAXSEQLEN */
+        if(p == stop || p - seq - 1 >= MAXSEQLEN) {
+            return seq - in;
+        }
+        if(ndigits > 0) {
+            params[np++] = num;
+        }
+        p0 = np > 0 ? params[0] : 0;
+        if(quesflag && !(*p == 'h' && np == 1 && p0 == 7)) {
+            return seq - in;
+        }
+        switch(*p++) {
+            case 'm':
+                break;
+            case 'h':
+                if(!quesflag) {
+                    return seq - in;
+                }
+                break;
+            case 'B': case 'C': case 'D': case 'G':
+                if(np > 1) {
+                    return seq - in;
+                }
+                break;
+            case 'A':
+                if(np > 1) {
+                    return seq - in;
+                }
+                p0 = np == 1 ? p0 : 1;
+                low = (unsigned int)p0 > low ? 0 : low - p0;
+                break;
+            case 'd':
+                if(np > 1) {
+                    return seq - in;
+                }
+                low = MAX(0, MIN((np == 1 ? p0 : 1) - 1, (int)nrows - 1));
+                break;
+            case 'H': case 'f':
+                if(np == 0 || (np == 1 && semicount > 0)) {
+                    low = 0;
+                } else if(np <= 2) {
+                    low = MAX(0, MIN(p0 - 1, (int)nrows - 1));
+                }
+                break;
+            case 's':
+                if(np != 0) {
+                    return seq - in;
+                }
+                savedlow = low;
+                saved = 1;
+                break;
+            case 'u':
+                if(np != 0 || !saved) {
+                    return seq - in;
+                }
+                low = savedlow;
+                break;
+            case 'K':
+                if(np > 1 || p0 > 2 || !keep) {
+                    return seq - in;
+                }
+                break;
+            case 'J':
+                /* 1 and 2 reach up; 0 only erases below */
+                if(np > 1 || (p0 != 0 && p0 != 3) || (p0 == 0 && !keep)) {
+                    return seq - in;
+                }
+                break;
+            default:
+                return seq - in;
+        }
+        if(low < end) {
+            return seq - in;
+        }
+    }
+    return len;
+}
+
+/* a fairly simple algorithm; straight replacement except for some special
+ * cases where we tweak the attributes.
+ *
+ * it's clear there were a lot of compromises made here:  the drawing characters
+ * are all demoted to roguelike-style boxes like this:   +---+-----+
+ * but this ends up more or less okay.  the real hurt    |   |     |
+ * came in deciding what to do for the shading colors    +---+-----+
+ * (0xb0-b2, 0xdb-df).  
+ * db-df are the trickiest, from my point of view; the approach taken here is 
+ * to reverse and use a space instead.  this is fine until we run into the
+ * problem of bold colors: there's no way to do bold backgrounds.  for some
+ * colors this doesn't matter; for others, we flip the ACF_BGBOLD flag.
+ */
+static const unsigned char cp437_to_ascii_map[] = {
+    /* 00 */  ' ', '@', '@', '*',   'x', 'A', '*', '*',
+    /* 08 */  '*', 'o', '*', '6',   'Q', 'f', 'M', '*',
+    /* 10 */  '>', '<', '$', '!',   'P', 'S', '_', '$',
+    /* 18 */  '^', 'v', '>', '<',   '_', '-', 'A', 'v',
+    /* 20 */  ' ', '!', '"', '#',   '$', '%', '&', '\'',
+    /* 28 */  '(', ')', '*', '+',   ',', '-', '.', '/',
+    /* 30 */  '0', '1', '2', '3',   '4', '5', '6', '7',
+    /* 38 */  '8', '9', ':', ';',   '<', '=', '>', '?',
+    /* 40 */  '@', 'A', 'B', 'C',   'D', 'E', 'F', 'G',
+    /* 48 */  'H', 'I', 'J', 'K',   'L', 'M', 'N', 'O',
+    /* 50 */  'P', 'Q', 'R', 'S',   'T', 'U', 'V', 'W',
+    /* 58 */  'X', 'Y', 'Z', '[',   '\\', ']', '^', '_',
+    /* 60 */  '`', 'a', 'b', 'c',   'd', 'e', 'f', 'g',
+    /* 68 */  'h', 'i', 'j', 'k',   'l', 'm', 'n', 'o',
+    /* 70 */  'p', 'q', 'r', 's',   't', 'u', 'v', 'w',
+    /* 78 */  'x', 'y', 'z', '{',   '|', '}', '~', '^',
+
+    /* 80 */  'C', 'u', 'e', 'a',   'a', 'a', 'a', 'c',
+    /* 88 */  'e', 'e', 'e', 'i',   'i', 'i', 'A', 'A',
+    /* 90 */  'E', '%', 'A', 'o',   'o', 'o', 'u', 'u',
+    /* 98 */  'y', 'O', 'U', 'c',   'L', 'Y', 'P', 'f',
+    /* a0 */  'a', 'i', 'o', 'u',   'n', 'N', '~', '^',
+    /* a8 */  '?', '+', '+', 'X',   'K', '!', '<', '>',
+    /* b0 */  '#', '@', '#', '|',   '+', '+', '+', '+',
+    /* b8 */  '+', '+', '|', '+',   '+', '+', '+', '+',
+    /* c0 */  '+', '+', '+', '+',   '-', '+', '+', '+',
+    /* c8 */  '+', '+', '+', '+',   '+', '=', '+', '+',
+    /* d0 */  '+', '+', '+', '+',   '+', '+', '+', '+',
+    /* d8 */  '+', '+', '+', ' ',   'm', '|', '|', '"',
+    /* e0 */  'a', 'B', 'r', 'n',   'E', 'q', 'u', 'r',
+    /* e8 */  'I', '0', '*', 'o',   '*', '0', 'E', 'n',
+    /* f0 */  '=', '+', '>', '<',   'l', 'j', '%', '=',
+    /* f8 */  '*', '.', '.', 'j',   'n', '2', '#', ' ',
+};
+static achar_t cp437_to_ascii(achar_t c) {
+    achar_t rest = ACREST(c);
+    unsigned char oldchar = ACCHAR(c);
+    if(oldchar == 0x02 || oldchar == 0xb2 || oldchar == 0xdb) {
+        rest ^= ACF_BGBOLD;
+        rest ^= ACF_INVERSE;
+    } else if(oldchar == 0xb1) {
+        rest ^= ACF_BOLD;
+    }
+    return rest | cp437_to_ascii_map[oldchar];
+}
+/* interpret and remove all attributes. */
+static achar_t normalize(achar_t c) {
+    if(c == default_char) {
+        return c;
+    }
+    achar_t flags = ACFLAGS(c);
+    unsigned char ch = ACCHAR(c);
+    unsigned int bgcolor = ACBG(c), fgcolor = ACFG(c), x;
+    if(flags & ACF_BOLD) {
+        fgcolor |= 8;
+    }
+    if(flags & ACF_BGBOLD) {
+        bgcolor |= 8;
+    }
+    if(flags & ACF_UNDERLINE) {
+        /* nothing right now */
+    }
+    if(flags & ACF_BLINK) {
+        /* nothing right now */
+    } 
+    if(flags & ACF_INVERSE) {
+        x = bgcolor;
+        bgcolor = fgcolor;
+        fgcolor = x;
+    }
+    return AC(ch, fgcolor, bgcolor, 0);
+}
+/* a cell once it's been through both: the character and the two colors
+ * shown, i.e. the low 16 bits of an achar_t with nothing left in the flags.
+ * rows are translated into these for output, which then moves half the
+ * bytes it would with achar_ts, and finds where the colors change by
+ * comparing the high bytes of 8 cells at once (see run_end()).  the screen
+ * itself can't be this small: the flags matter until the end.
+ */
+typedef u_int16_t cell_t;
+/* the same two steps for a whole row at a time, which is what the output pass
+ * actually uses.  xlat_tab folds cp437_to_ascii() into one word per byte: the
+ * ascii replacement in the low byte and the flags to flip above it, so a cell
+ * translates as (c & ~0xff) ^ xlat_tab[ACCHAR(c)].  normalize() is then bit
+ * arithmetic: ACF_BOLD and ACF_BGBOLD sit exactly 5 bits above the high bit of
+ * the fg and bg nibbles, and ACF_INVERSE swaps the nibbles.  default_char
+ * needs no case of its own, as it only differs from a written white on black
+ * blank in a flag the cell_t drops.  that has no branches per cell, so on x86
+ * it runs 16 (avx2) or 8 (sse2) cells at once; xlat_row_scalar() is the
+ * reference the vector versions have to match.
+ */
+static achar_t xlat_tab[256];
+/* the same with every character kept as it is, for the formats that can
+ * show the real cp437 glyphs: only normalize() is left
+ */
+static achar_t glyph_tab[256];
+static void (*xlat_row)(cell_t *dst, achar_t const *src, unsigned int n,
+        achar_t const *tab);
+/* "\x03FF,BB" for every pair of mirc colors; the first 3 bytes alone are the
+ * fg-only form.  filled in by xlat_init() along with xlat_tab.
+ */
+static char mirc_codes[16][16][6];
+/* a character or a color as it's written out: len bytes of s.  glyphs are
+ * always copied whole, so a buffer needs sizeof(s) bytes of room to put one
+ */
+struct glyph {
+    unsigned char len;
+    char s[7];
+};
+struct code {
+    unsigned char len;
+    char s[23];
+};
+/* cp437 in utf-8, and the same escaped for html.  filled in by xlat_init() */
+static struct glyph cp437_utf8[256], cp437_html[256];
+/* the SGR parameters setting each color as fg and as bg, 256-color and
+ * 24-bit; likewise filled in by xlat_init()
+ */
+static struct code sgr_fg[2][16], sgr_bg[2][16];
+
+static void xlat_row_scalar(cell_t *dst, achar_t const *src, unsigned int n,
+        achar_t const *tab) {
+    unsigned int j;
+    for(j = 0; j < n; j++) {
+        dst[j] = normalize((src[j] & ~0xff) ^ tab[ACCHAR(src[j])]);
+    }
+}
+#if defined(__x86_64__) || defined(__i386__)
+/* 4 cells, translated, in the low halves of their words */
+__attribute__((target("sse2")))
+static inline __m128i xlat4_sse2(achar_t const *src, achar_t const *tab) {
+    __m128i const chmask = _mm_set1_epi32(0xff), fgbgmask = _mm_set1_epi32(0xff00),
+          boldmask = _mm_set1_epi32(0x8800), invmask = _mm_set1_epi32(ACF_INVERSE),
+          lonib = _mm_set1_epi32(0x0f00), hinib = _mm_set1_epi32(0xf000);
+    __m128i c = _mm_loadu_si128((__m128i const *)src);
+    __m128i t = _mm_set_epi32(tab[ACCHAR(src[3])], tab[ACCHAR(src[2])],
+            tab[ACCHAR(src[1])], tab[ACCHAR(src[0])]);
+    __m128i c1 = _mm_xor_si128(_mm_andnot_si128(chmask, c), t);
+    __m128i fb = _mm_and_si128(_mm_or_si128(c1,
+                _mm_and_si128(_mm_srli_epi32(c1, 5), boldmask)), fgbgmask);
+    __m128i sw = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(fb, 4), lonib),
+            _mm_and_si128(_mm_slli_epi32(fb, 4), hinib));
+    __m128i inv = _mm_cmpeq_epi32(_mm_and_si128(c1, invmask), invmask);
+    fb = _mm_or_si128(_mm_and_si128(inv, sw), _mm_andnot_si128(inv, fb));
+    return _mm_or_si128(_mm_and_si128(c1, chmask), fb);
+}
+/* sse2 only packs 32 bits to 16 with signed saturation, so the cells are
+ * sign extended first to come through as they are
+ */
+__attribute__((target("sse2")))
+static void xlat_row_sse2(cell_t *dst, achar_t const *src, unsigned int n,
+        achar_t const *tab) {
+    unsigned int j;
+    for(j = 0; j + 8 <= n; j += 8) {
+        __m128i lo = xlat4_sse2(src + j, tab), hi = xlat4_sse2(src + j + 4, tab);
+        lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+        hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+        _mm_storeu_si128((__m128i *)(dst + j), _mm_packs_epi32(lo, hi));
+    }
+    xlat_row_scalar(dst + j, src + j, n - j, tab);
+}
+__attribute__((target("avx2")))
+static inline __m256i xlat8_avx2(achar_t const *src, achar_t const *tab) {
+    __m256i const chmask = _mm256_set1_epi32(0xff), fgbgmask = _mm256_set1_epi32(0xff00),
+          boldmask = _mm256_set1_epi32(0x8800), invmask = _mm256_set1_epi32(ACF_INVERSE),
+          lonib = _mm256_set1_epi32(0x0f00), hinib = _mm256_set1_epi32(0xf000);
+    __m256i c = _mm256_loadu_si256((__m256i const *)src);
+    __m256i t = _mm256_i32gather_epi32((int const *)tab,
+            _mm256_and_si256(c, chmask), 4);
+    __m256i c1 = _mm256_xor_si256(_mm256_andnot_si256(chmask, c), t);
+    __m256i fb = _mm256_and_si256(_mm256_or_si256(c1,
+                _mm256_and_si256(_mm256_srli_epi32(c1, 5), boldmask)), fgbgmask);
+    __m256i sw = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(fb, 4), lonib),
+            _mm256_and_si256(_mm256_slli_epi32(fb, 4), hinib));
+    __m256i inv = _mm256_cmpeq_epi32(_mm256_and_si256(c1, invmask), invmask);
+    fb = _mm256_blendv_epi8(fb, sw, inv);
+    return _mm256_or_si256(_mm256_and_si256(c1, chmask), fb);
+}
+/* the pack works within 128-bit lanes, leaving the quarters in the order
+ * 0 2 1 3; the permute puts them back.  the upper halves of the registers are
+ * cleared before the tail: gcc doesn't when there's a call after the loop,
+ * and the sse in the encoders would pay for it on every instruction.
+ */
+__attribute__((target("avx2")))
+static void xlat_row_avx2(cell_t *dst, achar_t const *src, unsigned int n,
+        achar_t const *tab) {
+    unsigned int j;
+    for(j = 0; j + 16 <= n; j += 16) {
+        __m256i r = _mm256_packus_epi32(xlat8_avx2(src + j, tab),
+                xlat8_avx2(src + j + 8, tab));
+        _mm256_storeu_si256((__m256i *)(dst + j), _mm256_permute4x64_epi64(r, 0xd8));
+    }
+    if(j + 8 <= n) {
+        __m256i r = xlat8_avx2(src + j, tab);
+        _mm_storeu_si128((__m128i *)(dst + j), _mm_packus_epi32(_mm256_castsi256_si128(r),
+                    _mm256_extracti128_si256(r, 1)));
+        j += 8;
+    }
+    _mm256_zeroupper();
+    xlat_row_scalar(dst + j, src + j, n - j, tab);
+}
+#endif
+/* what cp437 really looks like: the unicode for every glyph, including the
+ * ones drawn for control characters (NUL is shown as the blank it is)
+ */
+static const unsigned short cp437_unicode[256] = {
+    /* 00 */  0x0020, 0x263a, 0x263b, 0x2665,   0x2666, 0x2663, 0x2660, 0x2022,
+    /* 08 */  0x25d8, 0x25cb, 0x25d9, 0x2642,   0x2640, 0x266a, 0x266b, 0x263c,
+    /* 10 */  0x25ba, 0x25c4, 0x2195, 0x203c,   0x00b6, 0x00a7, 0x25ac, 0x21a8,
+    /* 18 */  0x2191, 0x2193, 0x2192, 0x2190,   0x221f, 0x2194, 0x25b2, 0x25bc,
+    /* 20 */  0x0020, 0x0021, 0x0022, 0x0023,   0x0024, 0x0025, 0x0026, 0x0027,
+    /* 28 */  0x0028, 0x0029, 0x002a, 0x002b,   0x002c, 0x002d, 0x002e, 0x002f,
+    /* 30 */  0x0030, 0x0031, 0x0032, 0x0033,   0x0034, 0x0035, 0x0036, 0x0037,
+    /* 38 */  0x0038, 0x0039, 0x003a, 0x003b,   0x003c, 0x003d, 0x003e, 0x003f,
+    /* 40 */  0x0040, 0x0041, 0x0042, 0x0043,   0x0044, 0x0045, 0x0046, 0x0047,
+    /* 48 */  0x0048, 0x0049, 0x004a, 0x004b,   0x004c, 0x004d, 0x004e, 0x004f,
+    /* 50 */  0x0050, 0x0051, 0x0052, 0x0053,   0x0054, 0x0055, 0x0056, 0x0057,
+    /* 58 */  0x0058, 0x0059, 0x005a, 0x005b,   0x005c, 0x005d, 0x005e, 0x005f,
+    /* 60 */  0x0060, 0x0061, 0x0062, 0x0063,   0x0064, 0x0065, 0x0066, 0x0067,
+    /* 68 */  0x0068, 0x0069, 0x006a, 0x006b,   0x006c, 0x006d, 0x006e, 0x006f,
+    /* 70 */  0x0070, 0x0071, 0x0072, 0x0073,   0x0074, 0x0075, 0x0076, 0x0077,
+    /* 78 */  0x0078, 0x0079, 0x007a, 0x007b,   0x007c, 0x007d, 0x007e, 0x2302,
+
+    /* 80 */  0x00c7, 0x00fc, 0x00e9, 0x00e2,   0x00e4, 0x00e0, 0x00e5, 0x00e7,
+    /* 88 */  0x00ea, 0x00eb, 0x00e8, 0x00ef,   0x00ee, 0x00ec, 0x00c4, 0x00c5,
+    /* 90 */  0x00c9, 0x00e6, 0x00c6, 0x00f4,   0x00f6, 0x00f2, 0x00fb, 0x00f9,
+    /* 98 */  0x00ff, 0x00d6, 0x00dc, 0x00a2,   0x00a3, 0x00a5, 0x20a7, 0x0192,
+    /* a0 */  0x00e1, 0x00ed, 0x00f3, 0x00fa,   0x00f1, 0x00d1, 0x00aa, 0x00ba,
+    /* a8 */  0x00bf, 0x2310, 0x00ac, 0x00bd,   0x00bc, 0x00a1, 0x00ab, 0x00bb,
+    /* b0 */  0x2591, 0x2592, 0x2593, 0x2502,   0x2524, 0x2561, 0x2562, 0x2556,
+    /* b8 */  0x2555, 0x2563, 0x2551, 0x2557,   0x255d, 0x255c, 0x255b, 0x2510,
+    /* c0 */  0x2514, 0x2534, 0x252c, 0x251c,   0x2500, 0x253c, 0x255e, 0x255f,
+    /* c8 */  0x255a, 0x2554, 0x2569, 0x2566,   0x2560, 0x2550, 0x256c, 0x2567,
+    /* d0 */  0x2568, 0x2564, 0x2565, 0x2559,   0x2558, 0x2552, 0x2553, 0x256b,
+    /* d8 */  0x256a, 0x2518, 0x250c, 0x2588,   0x2584, 0x258c, 0x2590, 0x2580,
+    /* e0 */  0x03b1, 0x00df, 0x0393, 0x03c0,   0x03a3, 0x03c3, 0x00b5, 0x03c4,
+    /* e8 */  0x03a6, 0x0398, 0x03a9, 0x03b4,   0x221e, 0x03c6, 0x03b5, 0x2229,
+    /* f0 */  0x2261, 0x00b1, 0x2265, 0x2264,   0x2320, 0x2321, 0x00f7, 0x2248,
+    /* f8 */  0x00b0, 0x2219, 0x00b7, 0x221a,   0x207f, 0x00b2, 0x25a0, 0x00a0,
+};
+/* the VGA palette, in ansi order (bold colors last) */
+static const unsigned char vga_rgb[16][3] = {
+    {0x00,0x00,0x00}, {0xaa,0x00,0x00}, {0x00,0xaa,0x00}, {0xaa,0x55,0x00},
+    {0x00,0x00,0xaa}, {0xaa,0x00,0xaa}, {0x00,0xaa,0xaa}, {0xaa,0xaa,0xaa},
+    {0x55,0x55,0x55}, {0xff,0x55,0x55}, {0x55,0xff,0x55}, {0xff,0xff,0x55},
+    {0x55,0x55,0xff}, {0xff,0x55,0xff}, {0x55,0xff,0xff}, {0xff,0xff,0xff},
+};
+static void put_utf8(struct glyph *g, unsigned int u) {
+    unsigned char *p = (unsigned char *)g->s;
+    if(u < 0x80) {
+        p[0] = u;
+        g->len = 1;
+    } else if(u < 0x800) {
+        p[0] = 0xc0 | (u >> 6);
+        p[1] = 0x80 | (u & 0x3f);
+        g->len = 2;
+    } else {
+        p[0] = 0xe0 | (u >> 12);
+        p[1] = 0x80 | ((u >> 6) & 0x3f);
+        p[2] = 0x80 | (u & 0x3f);
+        g->len = 3;
+    }
+}
+static pthread_once_t xlat_once = PTHREAD_ONCE_INIT;
+static void xlat_init(void) {
+    unsigned int i;
+    for(i = 0; i < 256; i++) {
+        xlat_tab[i] = cp437_to_ascii(i);
+        glyph_tab[i] = i;
+        put_utf8(&cp437_utf8[i], cp437_unicode[i]);
+        if(i == '&' || i == '<' || i == '>') {
+            cp437_html[i].len = sprintf(cp437_html[i].s, "&%s;",
+                    i == '&' ? "amp" : i == '<' ? "lt" : "gt");
+        } else {
+            cp437_html[i] = cp437_utf8[i];
+        }
+        mirc_codes[i >> 4][i & 0xf][0] = 0x3;
+        mirc_codes[i >> 4][i & 0xf][1] = '0' + (i >> 4) / 10;
+        mirc_codes[i >> 4][i & 0xf][2] = '0' + (i >> 4) % 10;
+        mirc_codes[i >> 4][i & 0xf][3] = ',';
+        mirc_codes[i >> 4][i & 0xf][4] = '0' + (i & 0xf) / 10;
+        mirc_codes[i >> 4][i & 0xf][5] = '0' + (i & 0xf) % 10;
+    }
+    for(i = 0; i < 16; i++) {
+        unsigned char const *c = vga_rgb[i];
+        sgr_fg[0][i].len = sprintf(sgr_fg[0][i].s, "38;5;%u", i);
+        sgr_bg[0][i].len = sprintf(sgr_bg[0][i].s, "48;5;%u", i);
+        sgr_fg[1][i].len = sprintf(sgr_fg[1][i].s, "38;2;%u;%u;%u", c[0], c[1], c[2]);
+        sgr_bg[1][i].len = sprintf(sgr_bg[1][i].s, "48;2;%u;%u;%u", c[0], c[1], c[2]);
+    }
+    xlat_row = xlat_row_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        xlat_row = xlat_row_avx2;
+    } else if(__builtin_cpu_supports("sse2")) {
+        xlat_row = xlat_row_sse2;
+    }
+#endif
+}
+/* make room for n more bytes at the end of b; -1 if out of memory */
+#define OBUFSZ 65536
+static int buf_reserve(struct noansi_buf *b, size_t n) {
+    if(b->cap - b->len < n) {
+        size_t ncap = MAX(b->cap ? b->cap * 2 : OBUFSZ, b->len + n);
+        char *nd = realloc(b->data, ncap);
+        if(nd == NULL) {
+            return -1;
+        }
+        b->data = nd;
+        b->cap = ncap;
+    }
+    return 0;
+}
+void noansi_buf_free(struct noansi_buf *buf) {
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = buf->cap = 0;
+}
+
+/* translation, attribute interpretation and output are done in one pass over
+ * the rows that will actually be printed.  the high-water marks from the
+ * parser say where each row (and the screen) ends, so trailing blanks never
+ * need to be searched for.
+ */
+/* the minimal encoding of a row of translated cells, for opts.minimal.  the
+ * plain encoding below sets the colors whenever either changes, in full;
+ * this one only sets what's visible and in as few bytes as it can:
+ *  - a space shows no foreground, so its fg is whatever's cheapest: the one
+ *    already set, or, when the bg has to be set anyway, the fg of the next
+ *    character drawn on the same bg, saving a code later on;
+ *  - a color is one digit unless it's 10 or up or a digit follows it;
+ *  - the bg is left out when it doesn't change.  that needs care when the
+ *    character is a ',' followed by a digit, which would be read as a bg;
+ *    then the bg is set (again) after all.
+ * ^O, the reset, isn't used: it goes back to the client's own colors, which
+ * aren't necessarily white on black.  nor is anything left to the colors a
+ * line starts with, for the same reason.
+ */
+static char *put_color(char *p, unsigned int color, int pad) {
+    if(color >= 10 || pad) {
+        *p++ = '0' + color / 10;
+    }
+    *p++ = '0' + color % 10;
+    return p;
+}
+/* write a character: the byte itself, or its glyph if there's a table.  the
+ * encoders below are all inlined into one function per table, so the test
+ * is gone by the time they run
+ */
+#define INLINE static inline __attribute__((always_inline))
+INLINE char *put_char(char *p, unsigned char ch, struct glyph const *glyphs) {
+    if(glyphs == NULL) {
+        *p++ = ch;
+        return p;
+    }
+    memcpy(p, glyphs[ch].s, sizeof(glyphs[ch].s));
+    return p + glyphs[ch].len;
+}
+INLINE char *encode_minimal(char *p, cell_t const *line, unsigned int n,
+        struct glyph const *glyphs) {
+    int curfg = -1, curbg = -1;
+    unsigned int j, k;
+    for(j = 0; j < n; j++) {
+        cell_t const c = line[j];
+        unsigned char const ch = ACCHAR(c);
+        int const fg = sgr_to_mirc[ACFG(c)], bg = sgr_to_mirc[ACBG(c)];
+        int const blank = ch == ' ', digit = ISDIGIT(ch);
+        if(bg != curbg || (!blank && fg != curfg && ch == ','
+                    && j + 1 < n && ISDIGIT(ACCHAR(line[j+1])))) {
+            int nfg = fg;
+            if(blank) {
+                /* the next thing drawn on this bg decides */
+                for(k = j + 1; k < n && ACCHAR(line[k]) == ' '
+                        && sgr_to_mirc[ACBG(line[k])] == bg; k++)
+                    ;
+                if(k < n && sgr_to_mirc[ACBG(line[k])] == bg) {
+                    nfg = sgr_to_mirc[ACFG(line[k])];
+                } else if(curfg >= 0) {
+                    nfg = curfg;
+                }
+            }
+            *p++ = 0x3;
+            p = put_color(p, nfg, 0);
+            *p++ = ',';
+            p = put_color(p, bg, digit);
+            curfg = nfg;
+            curbg = bg;
+        } else if(!blank && fg != curfg) {
+            *p++ = 0x3;
+            p = put_color(p, fg, digit || ch == ',');
+            curfg = fg;
+        }
+        p = put_char(p, ch, glyphs);
+    }
+    return p;
+}
+/* where the run of cells in line[j]'s colors that starts there ends: the
+ * next cell in others, or n.  the colors are the high byte of each cell, so
+ * with sse2 (which every x86-64 has) that's 8 cells a compare
+ */
+INLINE unsigned int run_end(cell_t const *line, unsigned int j, unsigned int n) {
+    unsigned int const colors = line[j] & 0xff00;
+#ifdef __SSE2__
+    __m128i const mask = _mm_set1_epi16((short)0xff00), want = _mm_set1_epi16((short)colors);
+    for(j++; j + 8 <= n; j += 8) {
+        __m128i c = _mm_and_si128(_mm_loadu_si128((__m128i const *)(line + j)), mask);
+        unsigned int other = ~_mm_movemask_epi8(_mm_cmpeq_epi16(c, want)) & 0xffff;
+        if(other != 0) {
+            return j + __builtin_ctz(other) / 2;
+        }
+    }
+#else
+    j++;
+#endif
+    for(; j < n && (line[j] & 0xff00) == colors; j++)
+        ;
+    return j;
+}
+/* the characters of line[j..k), as they are: the low bytes, packed 16 at a
+ * time with sse2 while there are 16 cells left in the row, even if the run
+ * ends sooner.  what's written past it is written over by the rest of the
+ * row, which is at least a byte a cell.
+ */
+INLINE char *put_chars(char *p, cell_t const *line, unsigned int j, unsigned int k,
+        unsigned int n) {
+#ifdef __SSE2__
+    __m128i const mask = _mm_set1_epi16(0xff);
+    for(; j < k && j + 16 <= n; j += 16) {
+        __m128i lo = _mm_and_si128(_mm_loadu_si128((__m128i const *)(line + j)), mask);
+        __m128i hi = _mm_and_si128(_mm_loadu_si128((__m128i const *)(line + j + 8)), mask);
+        _mm_storeu_si128((__m128i *)p, _mm_packus_epi16(lo, hi));
+        p += MIN(16, k - j);
+    }
+#endif
+    for(; j < k; j++) {
+        *p++ = ACCHAR(line[j]);
+    }
+    return p;
+}
+/* the plain encoding: both colors in full whenever the bg changes, the fg
+ * alone when only it does.  nothing changes within a run, so it goes a run
+ * at a time.  (two runs can still map to the same mirc colors.)
+ */
+INLINE char *encode_plain(char *p, cell_t const *line, unsigned int n,
+        struct glyph const *glyphs) {
+    unsigned int curfg = 65535, curbg = 65535, j, k;
+    for(j = 0; j < n; j = k) {
+        unsigned int const bgcolor = sgr_to_mirc[ACBG(line[j])];
+        unsigned int const fgcolor = sgr_to_mirc[ACFG(line[j])];
+        k = run_end(line, j, n);
+        if(curbg != bgcolor) {
+            memcpy(p, mirc_codes[fgcolor][bgcolor], 6);
+            p += 6;
+            curfg = fgcolor;
+            curbg = bgcolor;
+        } else if(curfg != fgcolor) {
+            memcpy(p, mirc_codes[fgcolor][bgcolor], 3);
+            p += 3;
+            curfg = fgcolor;
+        }
+        if(glyphs == NULL) {
+            p = put_chars(p, line, j, k, n);
+        } else {
+            unsigned int i;
+            for(i = j; i < k; i++) {
+                p = put_char(p, ACCHAR(line[i]), glyphs);
+            }
+        }
+    }
+    return p;
+}
+/* xterm: SGR sequences setting the colors, in the 256-color palette (whose
+ * first 16 are the terminal's own) or as the VGA's exact 24-bit ones.  a
+ * blank leaves the fg alone, so a run only ends where something visible
+ * changes, and every line is reset at its end so it stands alone.
+ */
+INLINE char *encode_sgr(char *p, cell_t const *line, unsigned int n, int truecolor) {
+    int curfg = -1, curbg = -1;
+    unsigned int j;
+    for(j = 0; j < n; j++) {
+        cell_t const c = line[j];
+        unsigned char const ch = ACCHAR(c);
+        int const bg = ACBG(c), fg = ch == ' ' && curfg >= 0 ? curfg : (int)ACFG(c);
+        if(fg != curfg || bg != curbg) {
+            struct code const *f = &sgr_fg[truecolor][fg], *b = &sgr_bg[truecolor][bg];
+            *p++ = 0x1b;
+            *p++ = '[';
+            if(fg != curfg) {
+                memcpy(p, f->s, f->len);
+                p += f->len;
+            }
+            if(bg != curbg) {
+                if(fg != curfg) {
+                    *p++ = ';';
+                }
+                memcpy(p, b->s, b->len);
+                p += b->len;
+            }
+            *p++ = 'm';
+            curfg = fg;
+            curbg = bg;
+        }
+        p = put_char(p, ch, cp437_utf8);
+    }
+    if(n > 0) {
+        memcpy(p, "\x1b[0m", 4);
+        p += 4;
+    }
+    return p;
+}
+/* html: a <span> per run of the same colors, merged over blanks the same
+ * way.  lines are meant to go in a <pre>, and every one closes its spans.
+ */
+static char const hexdigits[] = "0123456789abcdef";
+static char *put_hex(char *p, unsigned int color) {
+    unsigned int i;
+    for(i = 0; i < 3; i++) {
+        *p++ = hexdigits[vga_rgb[color][i] >> 4];
+        *p++ = hexdigits[vga_rgb[color][i] & 0xf];
+    }
+    return p;
+}
+INLINE char *encode_html(char *p, cell_t const *line, unsigned int n) {
+    int curfg = -1, curbg = -1;
+    unsigned int j;
+    for(j = 0; j < n; j++) {
+        cell_t const c = line[j];
+        unsigned char const ch = ACCHAR(c);
+        int const bg = ACBG(c), fg = ch == ' ' && curfg >= 0 ? curfg : (int)ACFG(c);
+        if(fg != curfg || bg != curbg) {
+            if(curfg >= 0) {
+                memcpy(p, "</span>", 7);
+                p += 7;
+            }
+            memcpy(p, "<span style=\"color:#", 20);
+            p = put_hex(p + 20, fg);
+            memcpy(p, ";background:#", 13);
+            p = put_hex(p + 13, bg);
+            memcpy(p, "\">", 2);
+            p += 2;
+            curfg = fg;
+            curbg = bg;
+        }
+        p = put_char(p, ch, cp437_html);
+    }
+    if(n > 0) {
+        memcpy(p, "</span>", 7);
+        p += 7;
+    }
+    return p;
+}
+
+static char *row_mirc(char *p, cell_t const *line, unsigned int n) {
+    return encode_plain(p, line, n, NULL);
+}
+static char *row_mirc_minimal(char *p, cell_t const *line, unsigned int n) {
+    return encode_minimal(p, line, n, NULL);
+}
+static char *row_mirc_utf8(char *p, cell_t const *line, unsigned int n) {
+    return encode_plain(p, line, n, cp437_utf8);
+}
+static char *row_mirc_utf8_minimal(char *p, cell_t const *line, unsigned int n) {
+    return encode_minimal(p, line, n, cp437_utf8);
+}
+static char *row_xterm(char *p, cell_t const *line, unsigned int n) {
+    return encode_sgr(p, line, n, 0);
+}
+static char *row_truecolor(char *p, cell_t const *line, unsigned int n) {
+    return encode_sgr(p, line, n, 1);
+}
+static char *row_html(char *p, cell_t const *line, unsigned int n) {
+    return encode_html(p, line, n);
+}
+
+/* the output formats.  each turns a row of cells, put through xlat_row()
+ * with its table, into bytes; the newline is added after.  at most cellmax
+ * bytes per cell and rowmax on top (some glyph slack included), so a row
+ * needs a single buf_reserve().  glyphs is what it writes characters as
+ * (NULL: the byte itself), which tells them from the codes for stats.  the
+ * second of each is for opts.minimal, which only the mirc formats have a
+ * use for.
+ */
+struct emitter {
+    achar_t const *tab;
+    struct glyph const *glyphs;
+    unsigned int cellmax, rowmax;
+    char *(*row)(char *p, cell_t const *line, unsigned int n);
+};
+static const struct emitter emitters[][2] = {
+    [NOANSI_MIRC] = {
+        { xlat_tab, NULL, 7, 1, row_mirc },
+        { xlat_tab, NULL, 7, 1, row_mirc_minimal } },
+    [NOANSI_MIRC_UTF8] = {
+        { glyph_tab, cp437_utf8, 9, 8, row_mirc_utf8 },
+        { glyph_tab, cp437_utf8, 9, 8, row_mirc_utf8_minimal } },
+    [NOANSI_XTERM] = {
+        { glyph_tab, cp437_utf8, 40, 16, row_xterm },
+        { glyph_tab, cp437_utf8, 40, 16, row_xterm } },
+    [NOANSI_TRUECOLOR] = {
+        { glyph_tab, cp437_utf8, 40, 16, row_truecolor },
+        { glyph_tab, cp437_utf8, 40, 16, row_truecolor } },
+    [NOANSI_HTML] = {
+        { glyph_tab, cp437_html, 64, 16, row_html },
+        { glyph_tab, cp437_html, 64, 16, row_html } },
+};
+#define NFORMATS (sizeof(emitters) / sizeof(emitters[0]))
+
+/* how many of the bytes a row of n cells came out as are its characters */
+static size_t text_bytes(cell_t const *line, unsigned int n, struct glyph const *glyphs) {
+    size_t len = n;
+    unsigned int j;
+    if(glyphs != NULL) {
+        for(len = 0, j = 0; j < n; j++) {
+            len += glyphs[ACCHAR(line[j])].len;
+        }
+    }
+    return len;
+}
+/* print screen rows [from, to), as far as they're in the range of lines
+ * asked for, in the format asked for
+ */
+static int output_rows(struct noansi_ctx *ctx, struct noansi_buf *o, unsigned int from,
+        unsigned int to) {
+    struct screen *screen = &ctx->screen;
+    struct emitter const *em = &emitters[ctx->opts.format][!!ctx->opts.minimal];
+    unsigned int const top = ctx->st.top;
+    unsigned int i;
+    cell_t line[MAXCOLS];
+    from = MAX(from, ctx->opts.start > top ? ctx->opts.start - top : 0);
+    to = MIN(to, ctx->opts.end > top ? ctx->opts.end - top : 0);
+    for(i = from; i < to; i++) {
+        achar_t *row = screen_peek(screen, i);
+        unsigned int stop = row ? screen->lens[i] : 0;
+        char *p;
+        if(buf_reserve(o, (size_t)stop * em->cellmax + em->rowmax) < 0) {
+            return nomem(ctx);
+        }
+        p = o->data + o->len;
+        xlat_row(line, row, stop, em->tab);
+        p = em->row(p, line, stop);
+        if(ctx->opts.stats) {
+            ctx->counts.colorbytes += (p - (o->data + o->len)) - text_bytes(line, stop, em->glyphs);
+        }
+        *p++ = '\n';
+        o->len = p - o->data;
+    }
+    return NOANSI_OK;
+}
+
+/* print n blank lines, starting at line first */
+static int output_blank(struct noansi_ctx *ctx, struct noansi_buf *o, unsigned int first,
+        unsigned int n) {
+    unsigned int from = MAX(first, ctx->opts.start), to = MIN(first + n, ctx->opts.end);
+    if(from >= to) {
+        return NOANSI_OK;
+    }
+    if(buf_reserve(o, to - from) < 0) {
+        return nomem(ctx);
+    }
+    memset(o->data + o->len, '\n', to - from);
+    o->len += to - from;
+    return NOANSI_OK;
+}
+
+/* streaming.  a row is final once the cursor can't get back to it.  the
+ * cursor only moves up with CUP, CUU and restoring a saved position, and
+ * the window option bounds how far above the lower of the cursor and the
+ * saved position those are allowed to reach: rows above that are printed
+ * and dropped.  a sequence that tries to go further up lands on the top row
+ * still held instead.  with a window as tall as the screen nothing is ever
+ * dropped early and the output is the same as noansi_convert()'s.
+ *
+ * blank rows below the last written one are only counted (in pending), and
+ * printed once something is written below them, just as trailing blank
+ * lines are left off the end of a whole-file conversion.
+ */
+static int stream_print(struct noansi_ctx *ctx, unsigned int n) {
+    struct stream *st = &ctx->st;
+    int rc;
+    if(n == 0) {
+        return NOANSI_OK;
+    }
+    if((rc = output_blank(ctx, st->out, st->top - st->pending, st->pending)) != NOANSI_OK
+            || (rc = output_rows(ctx, st->out, 0, n)) != NOANSI_OK) {
+        return rc;
+    }
+    st->pending = 0;
+    st->printed = 1;
+    return NOANSI_OK;
+}
+/* print and drop the top n rows */
+static int stream_drop(struct noansi_ctx *ctx, unsigned int n) {
+    struct stream *st = &ctx->st;
+    unsigned int written = MIN(n, ctx->screen.used);
+    int rc;
+    if((rc = stream_print(ctx, written)) != NOANSI_OK) {
+        return rc;
+    }
+    st->pending += n - written;
+    screen_drop(&ctx->screen, n);
+    st->top += n;
+    ctx->ps.x -= n;
+    if(ctx->ps.saved) {
+        ctx->ps.savedx -= n;
+    }
+    return NOANSI_OK;
+}
+/* the screen is about to be cleared: everything on it is final, and the
+ * next page starts again at line 0
+ */
+static int stream_page(struct noansi_ctx *ctx) {
+    int rc = stream_print(ctx, ctx->screen.used);
+    ctx->st.pending = 0;
+    ctx->st.top = 0;
+    return rc;
+}
+
+/* the render cache.  converting the same file with the same options always
+ * gives the same screen, so a cache maps a hash of the input and the
+ * options that shape the screen to the full render: every line, whatever
+ * range was asked for.  any START-END of it is then a slice, found through
+ * a per-line index, and a hit doesn't parse anything at all.
+ *
+ * entries are kept in memory up to a byte budget, least recently used going
+ * first, and, given a directory, also in a file each named after the key,
+ * which survives the process.  the cache is shared by any number of
+ * contexts, in any number of threads; it has its own lock.  it's only a
+ * cache: failing to write a file just means converting again next time.
+ *
+ * a hit can't count what the parse skipped, so an entry keeps those counts
+ * too, and a file has them on a line of its own ahead of the render.
+ */
+#define CACHEVERSION 3      /* bump whenever the output for an input, or the files, change */
+#define CACHEBUCKETS 4096
+struct cache_entry {
+    u_int64_t key[2];
+    char *data;                 /* the full render */
+    size_t len;
+    size_t *lines;              /* line i is data[lines[i]] up to lines[i+1] */
+    unsigned int nlines;
+    unsigned long skips[NOANSI_NSKIPS]; /* what the render skipped */
+    struct cache_entry *chain;  /* next in the same bucket */
+    struct cache_entry *prev, *next;    /* most recently used first */
+};
+struct noansi_cache {
+    pthread_mutex_t lock;
+    struct cache_entry *buckets[CACHEBUCKETS];
+    struct cache_entry *head, *tail;
+    size_t bytes, maxbytes;
+    char *dir;
+};
+
+/* murmurhash3 (x64, 128 bits); it's the collisions that matter here, not
+ * the speed, though it's not slow either
+ */
+static u_int64_t rotl64(u_int64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+static u_int64_t fmix64(u_int64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+static void hash128(void const *data, size_t len, u_int64_t seed, u_int64_t out[2]) {
+    u_int64_t const c1 = 0x87c37b91114253d5ULL, c2 = 0x4cf5ad432745937fULL;
+    unsigned char const *p = data;
+    u_int64_t h1 = seed, h2 = seed, k1, k2;
+    size_t i;
+    for(i = 0; i < len / 16; i++, p += 16) {
+        memcpy(&k1, p, 8);
+        memcpy(&k2, p + 8, 8);
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+    k1 = k2 = 0;
+    for(i = len & 15; i > 0; i--) {
+        if(i > 8) {
+            k2 ^= (u_int64_t)p[i-1] << ((i-9) * 8);
+        } else {
+            k1 ^= (u_int64_t)p[i-1] << ((i-1) * 8);
+        }
+    }
+    k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+    k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    h1 ^= len;
+    h2 ^= len;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+    out[0] = h1;
+    out[1] = h2;
+}
+/* start, end and window don't change the render, so they aren't in the key;
+ * the format does, and lenient mode, whose skips strict mode fails on
+ */
+static void cache_key(struct noansi_options const *opts, void const *in, size_t inlen,
+        u_int64_t key[2]) {
+    unsigned int const o[] = { CACHEVERSION, !!opts->expandtab, !!opts->includez,
+        opts->rows, opts->cols, !!opts->minimal, opts->format, !!opts->lenient };
+    u_int64_t seed[2];
+    hash128(o, sizeof(o), 0, seed);
+    hash128(in, inlen, seed[0] ^ seed[1], key);
+}
+
+static size_t entry_size(struct cache_entry const *e) {
+    return sizeof(*e) + e->len + (e->nlines + 1) * sizeof(size_t);
+}
+static void entry_free(struct cache_entry *e) {
+    if(e != NULL) {
+        free(e->data);
+        free(e->lines);
+        free(e);
+    }
+}
+/* an entry for the render in data[0..len), which it takes over (and frees
+ * if out of memory, returning NULL)
+ */
+static struct cache_entry *entry_new(u_int64_t const key[2], char *data, size_t len) {
+    struct cache_entry *e = calloc(1, sizeof(*e));
+    char const *p, *end = data + len;
+    unsigned int n = 0;
+    if(e == NULL) {
+        free(data);
+        return NULL;
+    }
+    e->key[0] = key[0];
+    e->key[1] = key[1];
+    e->data = data;
+    e->len = len;
+    for(p = data; (p = memchr(p, '\n', end - p)) != NULL; p++) {
+        e->nlines++;
+    }
+    if((e->lines = malloc((e->nlines + 1) * sizeof(size_t))) == NULL) {
+        entry_free(e);
+        return NULL;
+    }
+    e->lines[0] = 0;
+    for(p = data; (p = memchr(p, '\n', end - p)) != NULL; p++) {
+        e->lines[++n] = p + 1 - data;
+    }
+    return e;
+}
+/* append lines opts.start to opts.end of e to out */
+static int entry_slice(struct noansi_ctx *ctx, struct cache_entry const *e,
+        struct noansi_buf *out) {
+    unsigned int from = MIN(ctx->opts.start, e->nlines), to = MIN(ctx->opts.end, e->nlines);
+    size_t n;
+    if(from >= to) {
+        return NOANSI_OK;
+    }
+    n = e->lines[to] - e->lines[from];
+    if(buf_reserve(out, n) < 0) {
+        return nomem(ctx);
+    }
+    memcpy(out->data + out->len, e->data + e->lines[from], n);
+    out->len += n;
+    return NOANSI_OK;
+}
+
+/* these need the cache locked */
+static void cache_unlink(struct noansi_cache *c, struct cache_entry *e) {
+    if(e->prev != NULL) {
+        e->prev->next = e->next;
+    } else {
+        c->head = e->next;
+    }
+    if(e->next != NULL) {
+        e->next->prev = e->prev;
+    } else {
+        c->tail = e->prev;
+    }
+}
+static void cache_push(struct noansi_cache *c, struct cache_entry *e) {
+    e->prev = NULL;
+    e->next = c->head;
+    if(c->head != NULL) {
+        c->head->prev = e;
+    } else {
+        c->tail = e;
+    }
+    c->head = e;
+}
+static struct cache_entry *cache_find(struct noansi_cache *c, u_int64_t const key[2]) {
+    struct cache_entry *e = c->buckets[key[0] % CACHEBUCKETS];
+    while(e != NULL && (e->key[0] != key[0] || e->key[1] != key[1])) {
+        e = e->chain;
+    }
+    if(e != NULL) {
+        cache_unlink(c, e);
+        cache_push(c, e);
+    }
+    return e;
+}
+static void cache_remove(struct noansi_cache *c, struct cache_entry *e) {
+    struct cache_entry **pp = &c->buckets[e->key[0] % CACHEBUCKETS];
+    while(*pp != e) {
+        pp = &(*pp)->chain;
+    }
+    *pp = e->chain;
+    cache_unlink(c, e);
+    c->bytes -= entry_size(e);
+    entry_free(e);
+}
+/* keep e, making room for it; frees it instead if it's too big, or if
+ * another thread got there first
+ */
+static void cache_add(struct noansi_cache *c, struct cache_entry *e) {
+    size_t const size = entry_size(e);
+    struct cache_entry **bucket = &c->buckets[e->key[0] % CACHEBUCKETS];
+    if(size > c->maxbytes || cache_find(c, e->key) != NULL) {
+        entry_free(e);
+        return;
+    }
+    while(c->bytes + size > c->maxbytes) {
+        cache_remove(c, c->tail);
+    }
+    e->chain = *bucket;
+    *bucket = e;
+    cache_push(c, e);
+    c->bytes += size;
+}
+
+static char *cache_path(struct noansi_cache const *c, u_int64_t const key[2],
+        char const *suffix) {
+    size_t n = strlen(c->dir) + 40 + strlen(suffix);
+    char *path = malloc(n);
+    if(path != NULL) {
+        snprintf(path, n, "%s/%016llx%016llx%s", c->dir, (unsigned long long)key[0],
+                (unsigned long long)key[1], suffix);
+    }
+    return path;
+}
+/* the entry for key from the cache directory, or NULL */
+static struct cache_entry *cache_load(struct noansi_cache const *c, u_int64_t const key[2]) {
+    char *path = cache_path(c, key, ""), *data = NULL, *p, *q;
+    unsigned long skips[NOANSI_NSKIPS];
+    struct cache_entry *e;
+    struct stat st;
+    size_t len = 0;
+    ssize_t n = 1;
+    int fd, i;
+    if(path == NULL || (fd = open(path, O_RDONLY)) < 0) {
+        free(path);
+        return NULL;
+    }
+    free(path);
+    if(fstat(fd, &st) == 0 && st.st_size > 0 && (data = malloc(st.st_size)) != NULL) {
+        while(len < (size_t)st.st_size
+                && ((n = read(fd, data + len, st.st_size - len)) > 0 || errno == EINTR)) {
+            len += MAX(n, 0);
+        }
+    }
+    close(fd);
+    /* a render always ends a line; anything else is a partial file */
+    if(data == NULL || len < (size_t)st.st_size || data[len - 1] != '\n') {
+        free(data);
+        return NULL;
+    }
+    /* the counts: NOANSI_NSKIPS numbers and a newline */
+    for(i = 0, p = data; i < NOANSI_NSKIPS; i++, p = q) {
+        skips[i] = strtoul(p, &q, 10);
+        if(q == p || *q != (i < NOANSI_NSKIPS - 1 ? ' ' : '\n')) {
+            free(data);
+            return NULL;
+        }
+        q++;
+    }
+    len -= p - data;
+    memmove(data, p, len);
+    if((e = entry_new(key, data, len)) != NULL) {
+        memcpy(e->skips, skips, sizeof(skips));
+    }
+    return e;
+}
+/* all of data[0..len) to fd; -1 if it couldn't be */
+static int write_full(int fd, char const *data, size_t len) {
+    size_t off = 0;
+    ssize_t n;
+    while(off < len && ((n = write(fd, data + off, len - off)) > 0
+                || (n < 0 && errno == EINTR))) {
+        off += MAX(n, 0);
+    }
+    return off == len ? 0 : -1;
+}
+/* write e to the cache directory, by way of a temporary file so that nobody
+ * ever sees half of it
+ */
+static void cache_store(struct noansi_cache const *c, struct cache_entry const *e) {
+    char *path = cache_path(c, e->key, ""), *tmp = cache_path(c, e->key, ".XXXXXX");
+    char counts[NOANSI_NSKIPS * 21];
+    size_t hlen = 0;
+    int fd = -1, ok = 0, i;
+    for(i = 0; i < NOANSI_NSKIPS; i++) {
+        hlen += sprintf(counts + hlen, "%lu%c", e->skips[i], i < NOANSI_NSKIPS - 1 ? ' ' : '\n');
+    }
+    if(path != NULL && tmp != NULL && (fd = mkstemp(tmp)) >= 0) {
+        ok = write_full(fd, counts, hlen) == 0 && write_full(fd, e->data, e->len) == 0;
+        ok = close(fd) == 0 && ok && rename(tmp, path) == 0;
+        if(!ok) {
+            unlink(tmp);
+        }
+    }
+    free(path);
+    free(tmp);
+}
+
+/* animations.  instead of the final screen, the output is every frame, as
+ * the rows that changed since the one before:
+ *
+ *     frame N OFFSET
+ *     ROW TEXT
+ *     ...
+ *
+ * where N counts from 1, OFFSET is where in the input the frame ended, ROW
+ * is the screen row and TEXT its new contents, as a line of the usual
+ * output would be (a row that's been cleared is empty).  the first frame is
+ * against a blank screen.  rows outside start-end aren't printed, and
+ * frames in which nothing visible changed are left out altogether.
+ *
+ * a frame ends before a clear (CSI 2 J), when the cursor goes home (a
+ * redraw is starting), every opts.cadence bytes of input if that isn't 0 (a
+ * cadence of bytes is one of time at a given speed: 2400 baud is 240 bytes a
+ * second), and at the end.  the parser marks the rows it writes or clears as
+ * dirty, so a frame only looks at those.
+ */
+static int anim_frame(struct noansi_ctx *ctx, long pos) {
+    struct screen *s = &ctx->screen;
+    struct anim *an = &ctx->an;
+    struct noansi_buf *row = &an->row, *o = an->out;
+    u_int64_t h[2], blank[2];
+    unsigned int x;
+    int header = 0;
+    if(an->nprev < s->nslots) {
+        u_int64_t *np = realloc(an->prev, s->nslots * sizeof(u_int64_t));
+        if(np == NULL) {
+            return nomem(ctx);
+        }
+        hash128("\n", 1, 0, blank);
+        for(x = an->nprev; x < s->nslots; x++) {
+            np[x] = blank[0];
+        }
+        an->prev = np;
+        an->nprev = s->nslots;
+    }
+    for(x = 0; x < s->nslots; x++) {
+        if(!s->dirty[x]) {
+            continue;
+        }
+        s->dirty[x] = 0;
+        row->len = 0;
+        if(output_rows(ctx, row, x, x + 1) != NOANSI_OK) {
+            return NOANSI_ENOMEM;
+        }
+        if(row->len == 0) {
+            continue;
+        }
+        hash128(row->data, row->len, 0, h);
+        if(h[0] == an->prev[x]) {
+            continue;
+        }
+        an->prev[x] = h[0];
+        /* a header, the row number and the row */
+        if(buf_reserve(o, 64 + row->len) < 0) {
+            return nomem(ctx);
+        }
+        if(!header) {
+            o->len += sprintf(o->data + o->len, "frame %lu %ld\n", ++an->frames, pos);
+            header = 1;
+        }
+        o->len += sprintf(o->data + o->len, "%u ", x);
+        memcpy(o->data + o->len, row->data, row->len);
+        o->len += row->len;
+    }
+    return NOANSI_OK;
+}
+
+noansi_cache *noansi_cache_new(size_t maxbytes, char const *dir) {
+    noansi_cache *c = calloc(1, sizeof(*c));
+    if(c == NULL) {
+        return NULL;
+    }
+    if(dir != NULL && (c->dir = strdup(dir)) == NULL) {
+        free(c);
+        return NULL;
+    }
+    c->maxbytes = maxbytes;
+    pthread_mutex_init(&c->lock, NULL);
+    return c;
+}
+void noansi_cache_free(noansi_cache *c) {
+    if(c != NULL) {
+        while(c->head != NULL) {
+            cache_remove(c, c->head);
+        }
+        pthread_mutex_destroy(&c->lock);
+        free(c->dir);
+        free(c);
+    }
+}
+void noansi_set_cache(noansi_ctx *ctx, noansi_cache *cache) {
+    ctx->cache = cache;
+}
+
+/* SAUCE, the metadata record art packs put at the end of files: 128 bytes,
+ * after the comment block if there is one, after a ^Z ending the picture.
+ * see https://www.acid.org/info/sauce/sauce.htm.  the file size field is
+ * often wrong, so where the picture ends is worked out from the record's own
+ * position instead.
+ */
+#define SAUCELEN 128
+#define COMNTLINE 64
+static unsigned int le16(unsigned char const *p) {
+    return p[0] | p[1] << 8;
+}
+/* copy a space- (or NUL-) padded field, dropping the padding */
+static void sauce_field(char *dst, unsigned char const *src, size_t n) {
+    memcpy(dst, src, n);
+    while(n > 0 && (dst[n-1] == ' ' || dst[n-1] == 0)) {
+        n--;
+    }
+    dst[n] = 0;
+}
+int noansi_sauce_parse(void const *in, size_t inlen, struct noansi_sauce *sauce) {
+    unsigned char const *data = in, *r;
+    size_t end, i;
+    if(inlen < SAUCELEN || memcmp(data + inlen - SAUCELEN, "SAUCE00", 7) != 0) {
+        return 0;
+    }
+    r = data + inlen - SAUCELEN;
+    memset(sauce, 0, sizeof(*sauce));
+    sauce_field(sauce->title, r + 7, 35);
+    sauce_field(sauce->author, r + 42, 20);
+    sauce_field(sauce->group, r + 62, 20);
+    sauce_field(sauce->date, r + 82, 8);
+    sauce->filesize = le16(r + 90) | (unsigned long)le16(r + 92) << 16;
+    sauce->datatype = r[94];
+    sauce->filetype = r[95];
+    for(i = 0; i < 4; i++) {
+        sauce->tinfo[i] = le16(r + 96 + 2 * i);
+    }
+    sauce->flags = r[105];
+    sauce_field(sauce->font, r + 106, 22);
+    end = inlen - SAUCELEN;
+    /* the comments only count if they're really there */
+    if(r[104] > 0 && end >= 5 + (size_t)r[104] * COMNTLINE
+            && memcmp(data + end - 5 - r[104] * COMNTLINE, "COMNT", 5) == 0) {
+        sauce->ncomments = r[104];
+        sauce->comments = (char const *)data + end - r[104] * COMNTLINE;
+        end -= 5 + r[104] * COMNTLINE;
+    }
+    if(end > 0 && data[end-1] == 0x1a) {
+        end--;
+    }
+    sauce->datalen = end;
+    return 1;
+}
+void noansi_sauce_size(struct noansi_sauce const *sauce, unsigned int *width,
+        unsigned int *height) {
+    /* character data: ascii, ansi and ansimation */
+    if(sauce->datatype == 1 && sauce->filetype <= 2) {
+        *width = sauce->tinfo[0];
+        *height = sauce->tinfo[1];
+    } else {
+        *width = *height = 0;
+    }
+}
+
+void noansi_options_init(struct noansi_options *opts) {
+    opts->expandtab = 0;
+    opts->includez = 0;
+    opts->rows = NROWS;
+    opts->cols = NCOLS;
+    opts->start = 0;
+    opts->end = NCOLS;
+    opts->window = 25;
+    opts->minimal = 0;
+    opts->frames = 0;
+    opts->threads = 1;
+    opts->animate = 0;
+    opts->cadence = 0;
+    opts->format = NOANSI_MIRC;
+    opts->sauce = 0;
+    opts->lenient = 0;
+    opts->stats = 0;
+    opts->preview = NOANSI_PREVIEW_OFF;
+}
+noansi_ctx *noansi_new(struct noansi_options const *opts) {
+    noansi_ctx *ctx = calloc(1, sizeof(*ctx));
+    if(ctx == NULL) {
+        return NULL;
+    }
+    if(noansi_set_options(ctx, opts) != NOANSI_OK) {
+        free(ctx);
+        return NULL;
+    }
+    pthread_once(&xlat_once, xlat_init);
+    return ctx;
+}
+void noansi_free(noansi_ctx *ctx) {
+    if(ctx != NULL) {
+        screen_free(&ctx->screen);
+        free(ctx->an.prev);
+        noansi_buf_free(&ctx->an.row);
+        free(ctx);
+    }
+}
+int noansi_set_options(noansi_ctx *ctx, struct noansi_options const *opts) {
+    if(opts->rows < 1 || opts->cols < 1 || opts->cols > MAXCOLS) {
+        snprintf(ctx->errmsg, sizeof(ctx->errmsg), "invalid screen size %ux%u\n",
+                opts->cols, opts->rows);
+        return NOANSI_EINVAL;
+    }
+    if(opts->format < 0 || opts->format >= (int)NFORMATS) {
+        snprintf(ctx->errmsg, sizeof(ctx->errmsg), "invalid format %d\n", opts->format);
+        return NOANSI_EINVAL;
+    }
+    if(opts->preview < NOANSI_PREVIEW_OFF || opts->preview > NOANSI_PREVIEW_ROUGH) {
+        snprintf(ctx->errmsg, sizeof(ctx->errmsg), "invalid preview %d\n", opts->preview);
+        return NOANSI_EINVAL;
+    }
+    screen_fit(&ctx->screen, opts->rows, opts->cols);
+    ctx->opts = *opts;
+    return NOANSI_OK;
+}
+static void reset(noansi_ctx *ctx) {
+    ctx->errmsg[0] = 0;
+    memset(&ctx->counts, 0, sizeof(ctx->counts));
+    /* the last conversion may have been at the size of a SAUCE record */
+    screen_fit(&ctx->screen, ctx->opts.rows, ctx->opts.cols);
+    clear_screen(&ctx->screen);
+    parser_reset(&ctx->ps);
+    memset(&ctx->st, 0, sizeof(ctx->st));
+}
+/* opts.preview: parse a block at a time, and after each see whether the
+ * rest can still reach lines start to end.  returns how many rows to print:
+ * if the rest would have put anything below the window, all of it.  where
+ * the scan stops, it can't get past until the parser has, so it isn't
+ * tried again before then: all told it looks at every byte at most once.
+ */
+#ifndef PREVIEWBLOCK
+#define PREVIEWBLOCK 4096
+#endif
+static int read_preview(noansi_ctx *ctx, unsigned char const *in, size_t inlen,
+        unsigned int *rows) {
+    struct parser const *ps = &ctx->ps;
+    struct screen const *s = &ctx->screen;
+    unsigned int const end = ctx->opts.end;
+    unsigned char const *z;
+    size_t off = 0, n, blocked = 0, zoff = ctx->opts.includez ? inlen : 0;
+    int rc = NOANSI_OK, keep, writes;
+    *rows = 0;
+    while(off < inlen) {
+        n = MIN(inlen - off, PREVIEWBLOCK);
+        if((rc = read_ansi(ctx, in + off, n)) != NOANSI_OK || ps->state == S_STOP) {
+            return rc;
+        }
+        off += n;
+        if(off < blocked || ps->state != S_GROUND || ps->x < end
+                || (ps->saved && ps->savedx < end)) {
+            continue;
+        }
+        if(ctx->opts.preview == NOANSI_PREVIEW_ROUGH) {
+            return NOANSI_OK;
+        }
+        /* the next ^Z; the parser only goes past one in a bad escape */
+        if(zoff < off) {
+            z = memchr(in + off, 0x1a, inlen - off);
+            zoff = z != NULL ? (size_t)(z - in) : inlen;
+        }
+        keep = end == 0 || (end - 1 < s->nslots && s->lens[end - 1] > 0);
+        if((n = preview_scan(ctx, in + off, zoff - off, keep, &writes)) == zoff - off) {
+            if(keep || writes || s->used >= end) {
+                *rows = end;
+            }
+            return NOANSI_OK;
+        }
+        blocked = off + n + 1;
+    }
+    return rc;
+}
+static int render(noansi_ctx *ctx, void const *in, size_t inlen, struct noansi_buf *out) {
+    struct stopwatch w;
+    size_t outlen = out->len;
+    unsigned int rows = 0;
+    int rc;
+    reset(ctx);
+    watch_start(ctx, &w);
+    if(ctx->opts.preview) {
+        rc = read_preview(ctx, in, inlen, &rows);
+    } else {
+        rc = read_ansi(ctx, in, inlen);
+    }
+    if(rc == NOANSI_OK) {
+        rc = read_ansi_end(ctx);
+    }
+    watch_stop(ctx, &w, NOANSI_STAGE_PARSE);
+    /* an empty screen still gets its first line printed */
+    if(rc == NOANSI_OK) {
+        watch_start(ctx, &w);
+        rc = output_rows(ctx, out, 0, MAX(MAX(ctx->screen.used, 1), rows));
+        watch_stop(ctx, &w, NOANSI_STAGE_OUTPUT);
+    }
+    if(rc != NOANSI_OK) {
+        out->len = outlen;
+    }
+    return rc;
+}
+/* huge inputs, and frames.  a clear screen (CSI 2 J) cuts the input into
+ * segments that share nothing but the parser state at the cut: what's on
+ * the screen before it can't show after it.  so the segments can be parsed
+ * at the same time, on a screen each, if only the state each starts in is
+ * known.  it's predicted instead, from a quick scan of every segment for
+ * the attributes its SGRs leave set, and then the segments are parsed in
+ * parallel from their predictions.  once all are done they're checked in
+ * order, each against the state the one before really ended in, and any
+ * that were predicted wrong are parsed again, now knowing it.  a cut the
+ * parser doesn't get to in the ground state isn't one, since its CSI 2 J
+ * isn't parsed as a clear; that segment goes on the end of the one before.
+ * the result is exactly that of parsing the whole input in one go, errors
+ * and all.
+ *
+ * the screen of the last segment is the one that's printed (this thread
+ * parses that one while the workers do the rest); with opts.frames, every
+ * segment's is, one after the other, which is every frame of an animation.
+ * each segment starts at its CSI 2 J, not after it, so that its screen is
+ * the frame as it was before the next clear.
+ */
+#ifndef PARMIN
+#define PARMIN (1 << 20)    /* less input than this isn't worth splitting */
+#endif
+#define MAXTHREADS 64
+#define UNSET UINT_MAX
+struct segment {
+    size_t off, len;
+    /* from the scan: the attributes it leaves set (or UNSET), and whether it
+     * seems to save the cursor
+     */
+    unsigned int fg, bg, flags;
+    int save;
+    int done;
+    struct parser entry;    /* the parser state it was parsed from */
+    struct parser exit;     /* and the one it ended in */
+    int rc;
+    char errmsg[256];
+    struct counts counts;
+    struct noansi_buf out;  /* the frame, with opts.frames */
+};
+struct segments {
+    struct segment *segs;
+    size_t nsegs, next;
+    int scan;               /* scanning, or else parsing */
+    unsigned char const *in;
+    struct noansi_options const *opts;
+    double cpu;             /* the workers' cpu time, with opts.stats */
+    pthread_mutex_t lock;
+};
+/* cut in[0..inlen) before every CSI 2 J, up to the first ^Z where parsing
+ * has to stop: one right after an ESC may be skipped as a bad escape.
+ * -1 if out of memory
+ */
+static int split_segments(struct segments *sg, unsigned char const *in, size_t inlen,
+        int includez) {
+    unsigned char const *p = in, *end = in + inlen, *z = in;
+    size_t max = 0;
+    while(!includez && (z = memchr(z, 0x1a, end - z)) != NULL) {
+        if(z == in || z[-1] != 0x1b) {
+            end = z + 1;
+            break;
+        }
+        z++;
+    }
+    sg->segs = NULL;
+    sg->nsegs = 0;
+    for(;;) {
+        unsigned char const *cut = p;
+        struct segment *s;
+        while((cut = memchr(cut, 0x1b, end - cut)) != NULL
+                && (end - cut < 4 || memcmp(cut, "\x1b[2J", 4) != 0 || cut == p)) {
+            cut++;
+        }
+        if(cut == NULL) {
+            cut = end;
+        }
+        if(sg->nsegs == max) {
+            max = max ? max * 2 : 64;
+            if((s = realloc(sg->segs, max * sizeof(*s))) == NULL) {
+                return -1;
+            }
+            sg->segs = s;
+        }
+        s = &sg->segs[sg->nsegs++];
+        memset(s, 0, sizeof(*s));
+        s->off = p - in;
+        s->len = cut - p;
+        if(cut == end) {
+            return 0;
+        }
+        p = cut;
+    }
+}
+/* look at the sequences in s and nothing else.  this only has to be right
+ * for valid input, and even there a wrong prediction only costs time: what
+ * a segment really did with the saved position, which decides what's
+ * checked, comes from parsing it.
+ */
+static void scan_segment(struct segment *s, unsigned char const *in) {
+    unsigned char const *p = in + s->off, *end = p + s->len;
+    s->fg = s->bg = s->flags = UNSET;
+    while((p = memchr(p, 0x1b, end - p)) != NULL) {
+        int params[MAXSEQLEN], np = 0, num = 0, ndigits = 0, ques = 0, i;
+        for(p++; p < end && ((*p >= '0' && *p <= '9') || *p == ';' || *p == '?'
+                    || *p == '['); p++) {
+            if(*p >= '0' && *p <= '9') {
+                num = MIN(num * 10 + (*p - '0'), 9999);
+                ndigits++;
+            } else if(ndigits > 0 && np < MAXSEQLEN) {
+                params[np++] = num;
+                num = ndigits = 0;
+            }
+            ques |= *p == '?';
+        }
+        if(p == end) {
+            break;
+        }
+        if(ndigits > 0 && np < MAXSEQLEN) {
+            params[np++] = num;
+        }
+        if(*p == 'm' && !ques) {
+            if(np == 0) {
+                handle_sgr(0, &s->fg, &s->bg, &s->flags);
+            }
+            for(i = 0; i < np; i++) {
+                handle_sgr(params[i], &s->fg, &s->bg, &s->flags);
+            }
+        } else if(*p == 's') {
+            s->save = 1;
+        }
+    }
+}
+/* parse s on ctx's screen, starting from the state entry */
+static void parse_segment(noansi_ctx *ctx, struct segment *s, unsigned char const *in,
+        struct parser const *entry, int frames) {
+    ctx->errmsg[0] = 0;
+    memset(&ctx->counts, 0, sizeof(ctx->counts));
+    clear_screen(&ctx->screen);
+    ctx->ps = *entry;
+    ctx->ps.pos = s->off;
+    ctx->ps.savedhere = ctx->ps.lookedback = 0;
+    s->entry = *entry;
+    s->out.len = 0;
+    s->rc = read_ansi(ctx, in + s->off, s->len);
+    s->exit = ctx->ps;
+    s->counts = ctx->counts;
+    if(s->rc == NOANSI_OK && frames) {
+        s->rc = output_rows(ctx, &s->out, 0, MAX(ctx->screen.used, 1));
+    }
+    if(s->rc != NOANSI_OK) {
+        memcpy(s->errmsg, ctx->errmsg, sizeof(s->errmsg));
+    }
+    s->done = 1;
+}
+/* s, just parsed on ctx, takes in the len bytes after it: parsing goes on
+ * from where it stopped, on the same screen
+ */
+static void grow_segment(noansi_ctx *ctx, struct segment *s, unsigned char const *in,
+        size_t len, int frames) {
+    s->out.len = 0;
+    s->rc = read_ansi(ctx, in + s->off + s->len, len);
+    s->len += len;
+    s->exit = ctx->ps;
+    s->counts = ctx->counts;
+    if(s->rc == NOANSI_OK && frames) {
+        s->rc = output_rows(ctx, &s->out, 0, MAX(ctx->screen.used, 1));
+    }
+    if(s->rc != NOANSI_OK) {
+        memcpy(s->errmsg, ctx->errmsg, sizeof(s->errmsg));
+    }
+}
+/* the workers take segments from the front: to scan, all of them; to parse
+ * (from the predicted state in entry), all but the last
+ */
+static void *segment_worker(void *arg) {
+    struct segments *sg = arg;
+    noansi_ctx *ctx = sg->scan ? NULL : noansi_new(sg->opts);
+    while(sg->scan || ctx != NULL) {
+        struct segment *s;
+        pthread_mutex_lock(&sg->lock);
+        s = sg->next + !sg->scan < sg->nsegs ? &sg->segs[sg->next++] : NULL;
+        pthread_mutex_unlock(&sg->lock);
+        if(s == NULL) {
+            break;
+        } else if(sg->scan) {
+            scan_segment(s, sg->in);
+        } else {
+            parse_segment(ctx, s, sg->in, &s->entry, sg->opts->frames);
+        }
+    }
+    /* out of memory leaves the rest for the checking pass */
+    noansi_free(ctx);
+    return NULL;
+}
+/* a worker thread, which keeps track of its cpu time */
+static void *segment_thread(void *arg) {
+    struct segments *sg = arg;
+    struct timespec cpu;
+    if(sg->opts->stats) {
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    }
+    segment_worker(sg);
+    if(sg->opts->stats) {
+        double t = elapsed(&cpu, CLOCK_THREAD_CPUTIME_ID);
+        pthread_mutex_lock(&sg->lock);
+        sg->cpu += t;
+        pthread_mutex_unlock(&sg->lock);
+    }
+    return NULL;
+}
+/* run nthreads workers over sg, while this thread scans along with them,
+ * or parses the last segment on ctx
+ */
+static void run_workers(struct segments *sg, unsigned int nthreads, noansi_ctx *ctx) {
+    struct segment *last = &sg->segs[sg->nsegs - 1];
+    pthread_t threads[MAXTHREADS];
+    unsigned int n = 0, i;
+    sg->next = 0;
+    while(n < nthreads && pthread_create(&threads[n], NULL, segment_thread, sg) == 0) {
+        n++;
+    }
+    if(sg->scan) {
+        segment_worker(sg);
+    } else {
+        parse_segment(ctx, last, sg->in, &last->entry, sg->opts->frames);
+    }
+    for(i = 0; i < n; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+/* is a segment parsed from state b right, when it should have been a?  a
+ * is always in the ground state (a segment that would be entered in any
+ * other isn't one: see render_segments()), so the CSI 2 J the segment
+ * starts with really is one, and clears the screen and puts the cursor at
+ * 0,0 whatever they were.  so neither matters, nor does the saved position
+ * unless the parse looked back at it (restore is its exit's lookedback).
+ * the first segment has no CSI 2 J, but its b is the real initial state.
+ */
+static int same_entry(struct parser const *a, struct parser const *b, int restore) {
+    return a->state == b->state && a->curfg == b->curfg && a->curbg == b->curbg
+        && a->curflags == b->curflags && a->wrapping == b->wrapping
+        && (!restore || (a->saved == b->saved
+                    && (!a->saved || (a->savedx == b->savedx && a->savedy == b->savedy))));
+}
+static int render_segments(noansi_ctx *ctx, void const *in, size_t inlen,
+        struct noansi_buf *out) {
+    struct segments sg;
+    struct parser initial;
+    struct stopwatch w;
+    size_t outlen = out->len, k, held;
+    unsigned int nthreads = MIN(ctx->opts.threads, MAXTHREADS);
+    int rc = NOANSI_OK, frames = ctx->opts.frames;
+    if(split_segments(&sg, in, inlen, ctx->opts.includez) < 0) {
+        free(sg.segs);
+        return nomem(ctx);
+    }
+    if(sg.nsegs == 1 && !frames) {
+        free(sg.segs);
+        return render(ctx, in, inlen, out);
+    }
+    reset(ctx);
+    watch_start(ctx, &w);
+    initial = ctx->ps;
+    held = sg.nsegs - 1;
+    sg.cpu = 0;
+    if(nthreads > 1) {
+        struct parser guess = initial;
+        sg.in = in;
+        sg.opts = &ctx->opts;
+        pthread_mutex_init(&sg.lock, NULL);
+        sg.scan = 1;
+        run_workers(&sg, nthreads - 1, NULL);
+        for(k = 0; k < sg.nsegs; k++) {
+            struct segment *s = &sg.segs[k];
+            s->entry = guess;
+            guess.curfg = s->fg != UNSET ? s->fg : guess.curfg;
+            guess.curbg = s->bg != UNSET ? s->bg : guess.curbg;
+            guess.curflags = s->flags != UNSET ? s->flags : guess.curflags;
+            guess.saved |= s->save;
+        }
+        sg.scan = 0;
+        run_workers(&sg, MIN(nthreads - 1, sg.nsegs - 1), ctx);
+        pthread_mutex_destroy(&sg.lock);
+    }
+
+    /* in order, each from the state the one before really ended in.  one
+     * thread alone doesn't predict, and only does this.
+     */
+    for(k = 0; k < sg.nsegs; k++) {
+        struct segment *s = &sg.segs[k];
+        struct parser const *entry = k > 0 ? &sg.segs[k-1].exit : &initial;
+        if(k > 0 && entry->state != S_GROUND) {
+            /* the CSI 2 J it starts with isn't parsed as one (in lenient
+             * mode a bad sequence before it takes the ESC, or a ^Z stopped
+             * the parser), so it's no cut: it goes on the end of the one
+             * before.  that one is on ctx if it was parsed last; if not,
+             * it's parsed again
+             */
+            struct segment *t = &sg.segs[k-1];
+            size_t len = s->len;
+            noansi_buf_free(&s->out);
+            memmove(s, s + 1, (sg.nsegs - k - 1) * sizeof(*s));
+            sg.nsegs--;
+            if(held == k - 1) {
+                grow_segment(ctx, t, in, len, frames);
+            } else {
+                t->len += len;
+                parse_segment(ctx, t, in, k > 1 ? &sg.segs[k-2].exit : &initial, frames);
+            }
+            held = --k;
+            s = t;
+        } else if(!s->done || !same_entry(entry, &s->entry, s->exit.lookedback)) {
+            parse_segment(ctx, s, in, entry, frames);
+            held = k;
+        } else if(!s->exit.savedhere) {
+            /* the saved position it didn't touch is the one it came in with */
+            s->exit.saved = entry->saved;
+            s->exit.savedx = entry->savedx;
+            s->exit.savedy = entry->savedy;
+        }
+        if(s->rc != NOANSI_OK) {
+            memcpy(ctx->errmsg, s->errmsg, sizeof(ctx->errmsg));
+            rc = s->rc;
+            break;
+        }
+    }
+    if(rc == NOANSI_OK && !frames && held != sg.nsegs - 1) {
+        /* the last screen is the one printed, so it has to be on ctx */
+        k = sg.nsegs - 1;
+        parse_segment(ctx, &sg.segs[k], in, k > 0 ? &sg.segs[k-1].exit : &initial, 0);
+    }
+    /* every segment counted its own, as parsed from its real entry; up to
+     * the one that failed, if one did
+     */
+    memset(&ctx->counts, 0, sizeof(ctx->counts));
+    for(k = 0; k < sg.nsegs; k++) {
+        counts_add(&ctx->counts, &sg.segs[k].counts);
+        if(sg.segs[k].rc != NOANSI_OK) {
+            break;
+        }
+    }
+    if(rc == NOANSI_OK) {
+        /* a ^Z that stopped the parser is in the last segment: any after it
+         * were put on the end of it
+         */
+        ctx->ps = sg.segs[sg.nsegs-1].exit;
+        rc = read_ansi_end(ctx);
+    }
+    watch_stop(ctx, &w, NOANSI_STAGE_PARSE);
+    ctx->stats.cpu[NOANSI_STAGE_PARSE] += sg.cpu;
+    watch_start(ctx, &w);
+    if(rc == NOANSI_OK && frames) {
+        for(k = 0; k < sg.nsegs && rc == NOANSI_OK; k++) {
+            if(buf_reserve(out, sg.segs[k].out.len) < 0) {
+                rc = nomem(ctx);
+            } else if(sg.segs[k].out.len > 0) {
+                memcpy(out->data + out->len, sg.segs[k].out.data, sg.segs[k].out.len);
+                out->len += sg.segs[k].out.len;
+            }
+        }
+    } else if(rc == NOANSI_OK) {
+        rc = output_rows(ctx, out, 0, MAX(ctx->screen.used, 1));
+    }
+    watch_stop(ctx, &w, NOANSI_STAGE_OUTPUT);
+    if(rc != NOANSI_OK) {
+        out->len = outlen;
+    }
+    for(k = 0; k < sg.nsegs; k++) {
+        noansi_buf_free(&sg.segs[k].out);
+    }
+    free(sg.segs);
+    return rc;
+}
+static int render_animation(noansi_ctx *ctx, void const *in, size_t inlen,
+        struct noansi_buf *out) {
+    struct anim *an = &ctx->an;
+    unsigned char const *p = in;
+    struct stopwatch w;
+    size_t outlen = out->len, done = 0, n;
+    int rc = NOANSI_OK;
+    reset(ctx);
+    watch_start(ctx, &w);
+    if(ctx->screen.nslots > 0) {
+        memset(ctx->screen.dirty, 0, ctx->screen.nslots);
+    }
+    an->nprev = 0;
+    an->frames = 0;
+    an->out = out;
+    an->on = 1;
+    while(rc == NOANSI_OK && done < inlen) {
+        n = ctx->opts.cadence ? MIN(inlen - done, ctx->opts.cadence) : inlen - done;
+        ctx->ps.pos = done;
+        if((rc = read_ansi(ctx, p + done, n)) == NOANSI_OK && ctx->opts.cadence) {
+            rc = anim_frame(ctx, done + n);
+        }
+        done += n;
+    }
+    if(rc == NOANSI_OK && (rc = read_ansi_end(ctx)) == NOANSI_OK) {
+        rc = anim_frame(ctx, inlen);
+    }
+    an->on = 0;
+    an->out = NULL;
+    watch_stop(ctx, &w, NOANSI_STAGE_PARSE);
+    if(rc != NOANSI_OK) {
+        out->len = outlen;
+    }
+    return rc;
+}
+static int render_any(noansi_ctx *ctx, void const *in, size_t inlen,
+        struct noansi_buf *out) {
+    if(ctx->opts.animate) {
+        return render_animation(ctx, in, inlen, out);
+    }
+    /* a preview is cheaper on one thread than the whole input on many */
+    if(ctx->opts.frames
+            || (ctx->opts.threads > 1 && inlen >= PARMIN && !ctx->opts.preview)) {
+        return render_segments(ctx, in, inlen, out);
+    }
+    return render(ctx, in, inlen, out);
+}
+/* through the cache: the memory, then the directory, and only then a full
+ * render, which goes into both.  a hit has the counts of what the render
+ * skipped, if not of anything else.
+ */
+static int render_cached(noansi_ctx *ctx, void const *in, size_t inlen,
+        struct noansi_buf *out) {
+    struct noansi_cache *c = ctx->cache;
+    struct noansi_buf full = { 0 };
+    struct cache_entry *e;
+    struct stopwatch w;
+    unsigned int start = ctx->opts.start, end = ctx->opts.end;
+    u_int64_t key[2];
+    int rc;
+    watch_start(ctx, &w);
+    cache_key(&ctx->opts, in, inlen, key);
+    pthread_mutex_lock(&c->lock);
+    if((e = cache_find(c, key)) != NULL) {
+        ctx->errmsg[0] = 0;
+        ctx->stats.cached = 1;
+        memcpy(ctx->counts.skips, e->skips, sizeof(e->skips));
+        rc = entry_slice(ctx, e, out);
+        pthread_mutex_unlock(&c->lock);
+        watch_stop(ctx, &w, NOANSI_STAGE_CACHE);
+        return rc;
+    }
+    pthread_mutex_unlock(&c->lock);
+    e = c->dir != NULL ? cache_load(c, key) : NULL;
+    watch_stop(ctx, &w, NOANSI_STAGE_CACHE);
+    if(e == NULL) {
+        ctx->opts.start = 0;
+        ctx->opts.end = UINT_MAX;
+        rc = render_any(ctx, in, inlen, &full);
+        ctx->opts.start = start;
+        ctx->opts.end = end;
+        if(rc != NOANSI_OK) {
+            noansi_buf_free(&full);
+            return rc;
+        }
+        watch_start(ctx, &w);
+        if((e = entry_new(key, full.data, full.len)) == NULL) {
+            return nomem(ctx);
+        }
+        memcpy(e->skips, ctx->counts.skips, sizeof(e->skips));
+        if(c->dir != NULL) {
+            cache_store(c, e);
+        }
+    } else {
+        ctx->stats.cached = 1;
+        memcpy(ctx->counts.skips, e->skips, sizeof(e->skips));
+        watch_start(ctx, &w);
+    }
+    ctx->errmsg[0] = 0;
+    rc = entry_slice(ctx, e, out);
+    pthread_mutex_lock(&c->lock);
+    cache_add(c, e);
+    pthread_mutex_unlock(&c->lock);
+    watch_stop(ctx, &w, NOANSI_STAGE_CACHE);
+    return rc;
+}
+static int convert(noansi_ctx *ctx, void const *in, size_t inlen, struct noansi_buf *out) {
+    /* a line range is of each frame, not of all of them, so frames can't
+     * be sliced out of the cache
+     */
+    if(ctx->cache != NULL && !ctx->opts.frames && !ctx->opts.animate) {
+        return render_cached(ctx, in, inlen, out);
+    }
+    return render_any(ctx, in, inlen, out);
+}
+/* the input, less any SAUCE record */
+static int convert_input(noansi_ctx *ctx, void const *in, size_t inlen,
+        struct noansi_buf *out) {
+    struct noansi_options const saved = ctx->opts;
+    struct noansi_sauce sauce;
+    unsigned int width, height;
+    int rc;
+    if(!ctx->opts.sauce || !noansi_sauce_parse(in, inlen, &sauce)) {
+        return convert(ctx, in, inlen, out);
+    }
+    /* the record and anything that goes with it aren't part of the picture,
+     * and it knows how big the picture is.  the options change for this
+     * conversion only (they're what the cache key and any worker threads
+     * go by); the screen stays at this size until the next reset() needs
+     * another.
+     */
+    noansi_sauce_size(&sauce, &width, &height);
+    if(width > 0) {
+        ctx->opts.cols = MIN(width, MAXCOLS);
+    }
+    screen_fit(&ctx->screen, ctx->opts.rows, ctx->opts.cols);
+    if(height > 0 && screen_reserve(&ctx->screen, MIN(height, ctx->opts.rows)) < 0) {
+        rc = nomem(ctx);
+    } else {
+        rc = convert(ctx, in, sauce.datalen, out);
+    }
+    ctx->opts = saved;
+    return rc;
+}
+int noansi_convert(noansi_ctx *ctx, void const *in, size_t inlen, struct noansi_buf *out) {
+    size_t outlen = out->len;
+    int rc;
+    /* a cache hit doesn't reset(), so the counts start over here too */
+    memset(&ctx->counts, 0, sizeof(ctx->counts));
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+    ctx->stats.bytes = inlen;
+    rc = convert_input(ctx, in, inlen, out);
+    ctx->stats.outbytes = out->len - outlen;
+    return rc;
+}
+int noansi_stream_begin(noansi_ctx *ctx) {
+    reset(ctx);
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+    ctx->st.on = 1;
+    return NOANSI_OK;
+}
+/* fed in pieces of at most STREAMBLOCK bytes, so the rows held between one
+ * drop and the next stay bounded however much is fed at once
+ */
+#define STREAMBLOCK 65536
+int noansi_stream_feed(noansi_ctx *ctx, void const *in, size_t inlen, struct noansi_buf *out) {
+    unsigned char const *p = in;
+    struct parser *ps = &ctx->ps;
+    struct stopwatch w;
+    size_t outlen = out->len;
+    int rc = NOANSI_OK;
+    ctx->st.out = out;
+    ctx->stats.bytes += inlen;
+    while(inlen > 0 && rc == NOANSI_OK) {
+        size_t n = MIN(inlen, STREAMBLOCK);
+        unsigned int low;
+        watch_start(ctx, &w);
+        rc = read_ansi(ctx, p, n);
+        watch_stop(ctx, &w, NOANSI_STAGE_PARSE);
+        if(rc != NOANSI_OK) {
+            break;
+        }
+        p += n;
+        inlen -= n;
+        low = ps->saved ? MIN(ps->x, ps->savedx) : ps->x;
+        if(low > ctx->opts.window) {
+            watch_start(ctx, &w);
+            rc = stream_drop(ctx, low - ctx->opts.window);
+            watch_stop(ctx, &w, NOANSI_STAGE_OUTPUT);
+        }
+    }
+    ctx->st.out = NULL;
+    ctx->stats.outbytes += out->len - outlen;
+    return rc;
+}
+int noansi_stream_end(noansi_ctx *ctx, struct noansi_buf *out) {
+    struct stopwatch w;
+    size_t outlen = out->len;
+    int rc;
+    if((rc = read_ansi_end(ctx)) != NOANSI_OK) {
+        return rc;
+    }
+    watch_start(ctx, &w);
+    ctx->st.out = out;
+    rc = stream_print(ctx, ctx->screen.used);
+    if(rc == NOANSI_OK && !ctx->st.printed) {
+        /* like an empty screen from noansi_convert() */
+        rc = output_blank(ctx, out, 0, 1);
+    }
+    ctx->st.out = NULL;
+    ctx->st.on = 0;
+    watch_stop(ctx, &w, NOANSI_STAGE_OUTPUT);
+    ctx->stats.outbytes += out->len - outlen;
+    return rc;
+}
+unsigned long const *noansi_skipped(noansi_ctx const *ctx) {
+    return ctx->counts.skips;
+}
+void noansi_stats(noansi_ctx const *ctx, struct noansi_stats *stats) {
+    struct counts const *c = &ctx->counts;
+    *stats = ctx->stats;
+    stats->cells = c->cells;
+    memcpy(stats->seqs, c->seqs, sizeof(stats->seqs));
+    stats->sgr = c->sgr;
+    stats->sgr_ignored = c->sgr_ignored;
+    stats->sgr_invalid = c->sgr_invalid;
+    stats->rows = c->rows;
+    stats->maxrow = c->maxrow;
+    stats->clamps = c->clamps;
+    stats->colorbytes = c->colorbytes;
+}
+char const *noansi_format_name(int format) {
+    static char const *const names[NFORMATS] = {
+        [NOANSI_MIRC] = "mirc", [NOANSI_MIRC_UTF8] = "mirc-utf8",
+        [NOANSI_XTERM] = "xterm", [NOANSI_TRUECOLOR] = "truecolor",
+        [NOANSI_HTML] = "html",
+    };
+    return format >= 0 && format < (int)NFORMATS ? names[format] : NULL;
+}
+char const *noansi_stage_name(int stage) {
+    static char const *const names[NOANSI_NSTAGES] = {
+        [NOANSI_STAGE_CACHE] = "cache", [NOANSI_STAGE_PARSE] = "parse",
+        [NOANSI_STAGE_OUTPUT] = "output",
+    };
+    return stage >= 0 && stage < NOANSI_NSTAGES ? names[stage] : NULL;
+}
+char const *noansi_skip_name(int kind) {
+    static char const *const names[NOANSI_NSKIPS] = {
+        [NOANSI_SKIP_ESCAPE] = "escape", [NOANSI_SKIP_LENGTH] = "length",
+        [NOANSI_SKIP_NUMBER] = "number", [NOANSI_SKIP_FORM] = "form",
+        [NOANSI_SKIP_RESTORE] = "restore", [NOANSI_SKIP_UNKNOWN] = "unknown",
+        [NOANSI_SKIP_SGR] = "sgr", [NOANSI_SKIP_EOF] = "eof",
+    };
+    return kind >= 0 && kind < NOANSI_NSKIPS ? names[kind] : NULL;
+}
+char const *noansi_error(noansi_ctx const *ctx) {
+    return ctx->errmsg;
+}
@@ -1,569 +1,769 @@
 #include <stdio.h>
-#include <ctype.h>
 #include <stdlib.h>
-#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "noansi.h"
 
 /* noansi: rough translator from cp437+dosansi -> ascii+mirc colors
  * cstone@pobox.com
  *
  * run noansi -h for usage
  *
- * R.I.P. BANTOWN
- *
- * references used here: ctlseqs.ms (xorg source); ms-dos 6.22 help (ansi.sys);
- * ecma-48; (http://www.ecma-international.org/publications/standards/Ecma-048.htm);
- * NANSI source (4.0, earlier); various comp.terminals searches; dosbox
+ * this is the command line front end; the translation itself is in
+ * libnoansi.c.
  *
- * (it should be noted that none of these perfectly explains why sequences like SGR 55
- * or SGR 48 (esp. in constructions like in CSI 1 ; 48 m, which makes no sense
- * and doesn't seem to do anything) end up in ansis from the early 1990s &
- * intended for visual display only.  SGR 48, 53, 55 are always silently ignored.)
+ * build: cc -O2 -pthread -o noansi noansi.c libnoansi.c
  *
- * also unknown: CSI 0x4b 0x4d
+ * R.I.P. BANTOWN
  */
-#define NCOLS 80
-#define NROWS 1024
-#define MAXSEQLEN 64
-enum { 
-    /* mirc color codes; from http://www.mirc.co.uk/help/color.txt */
-        mWHITE = 0,   mBLACK = 1,   mBLUE = 2,   mGREEN = 3,
-        mRED = 4,     mBROWN = 5,   mPURPLE = 6, mORANGE = 7,
-        mYELLOW = 8,  mLTGREEN = 9, mTEAL = 10,  mCYAN = 11,
-        mLTBLUE = 12, mPINK = 13,   mGREY = 14,  mLTGREY = 15,
-
-    /* iso/ansi color pattern. +30 for fg, +40 for bg */
-        aBLACK = 0, aRED = 1,     aGREEN = 2, aYELLOW = 3,
-        aBLUE = 4,  aMAGENTA = 5, aCYAN = 6,  aWHITE = 7,
-
-    /* SGR flags (that we support here); see below */
-        ACF_BOLD =    0x10000, ACF_UNDERLINE =  0x20000,
-        ACF_BLINK =   0x40000, ACF_INVERSE =    0x80000,
-        ACF_BGBOLD = 0x100000, 
-        
-    /* special "unchanged" flag used in default_char */
-        ACF_UNCHANGED = 0x200000,
-};
-const int sgr_to_mirc[] = {
-    mBLACK,  mRED, mGREEN,   mYELLOW, mBLUE,   mPURPLE, mCYAN, mLTGREY,
-    mGREY,  mPINK, mLTGREEN, mYELLOW, mLTBLUE, mPINK,   mTEAL, mWHITE
-};
 
-/* bits 0-7 of achar_t are the character; bits 8-11 are the fg color; bits
- * 12-15 are the bg color; the rest are flags
+/* an input file held in memory: regular files are mapped, anything else
+ * (pipes, ttys) is read in large blocks.  load_input() returns -1 with errno
+ * set if it fails.
  */
-typedef u_int32_t achar_t;
-#define AC(chr,fg,bg,flags) ((chr & 0xff) | ((fg & 0xf) << 8) | ((bg & 0xf) << 12) | (flags & 0xffff0000))
-#define ACCHAR(x) ((unsigned char)(x & 0xff))
-#define ACREST(x) (x & 0xffffff00)
-#define ACFG(x) ((x >> 8) & 0xf)
-#define ACBG(x) ((x >> 12) & 0xf)
-#define ACFLAGS(x) (x & 0xffff0000)
-
-#ifndef MAX
-#define MAX(x,y) ((x) > (y) ? (x) : (y))
-#endif
-#ifndef MIN
-#define MIN(x,y) ((x) > (y) ? (y) : (x))
-#endif
-
-static const unsigned int default_fg = aWHITE, default_bg = aBLACK;
-static const unsigned char default_ch = ' ';
-static const achar_t default_char = AC(' ', aWHITE, aBLACK, ACF_UNCHANGED);
-
-static int expandtab = 0;
-static int includez = 0;
+#define READBLOCK 65536
+struct input {
+    unsigned char *data;
+    size_t len;
+    int mapped;
+};
+static int load_input(int fd, struct input *in) {
+    struct stat st;
+    size_t cap = 0;
+    ssize_t n;
+    in->data = NULL;
+    in->len = 0;
+    in->mapped = 0;
+    if(fstat(fd, &st) < 0) {
+        return -1;
+    }
+    if(S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(m != MAP_FAILED) {
+            madvise(m, st.st_size, MADV_SEQUENTIAL);
+            in->data = m;
+            in->len = st.st_size;
+            in->mapped = 1;
+            return 0;
+        }
+    }
+    for(;;) {
+        if(cap - in->len < READBLOCK) {
+            unsigned char *nd = realloc(in->data, cap ? cap * 2 : READBLOCK * 4);
+            if(nd == NULL) {
+                free(in->data);
+                in->data = NULL;
+                errno = ENOMEM;
+                return -1;
+            }
+            in->data = nd;
+            cap = cap ? cap * 2 : READBLOCK * 4;
+        }
+        n = read(fd, in->data + in->len, cap - in->len);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n < 0) {
+            free(in->data);
+            in->data = NULL;
+            return -1;
+        }
+        if(n == 0) {
+            return 0;
+        }
+        in->len += n;
+    }
+}
+static void free_input(struct input *in) {
+    if(in->mapped) {
+        munmap(in->data, in->len);
+    } else {
+        free(in->data);
+    }
+    in->data = NULL;
+}
 
-static int errors = 0;
+/* write all of buf to fd; -1 with errno set if that fails */
+static int write_all(int fd, char const *buf, size_t len) {
+    while(len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            if(n == 0) {
+                errno = EIO;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
 
-static void doerror(char const *fmt, ...) {
-    va_list va;
-    va_start(va, fmt);
-    vfprintf(stderr, fmt, va);
-    va_end(va);
-    if(errors == 0) {
-        abort();
+/* append a line describing in's SAUCE record to out: path, whether there is
+ * one, its data and file types, width, height, the length of the picture,
+ * date, title, author and group, separated by tabs.  -1 if out of memory.
+ */
+static void clean_field(char *s) {
+    for(; *s; s++) {
+        if((unsigned char)*s < ' ') {
+            *s = ' ';
+        }
     }
 }
-static void handle_sgr(int sgrcode, unsigned int *curfg, unsigned int *curbg,
-        unsigned int *curflags) {
-    switch(sgrcode) {
-        case 0:
-            *curflags = 0;
-            *curfg = default_fg;
-            *curbg = default_bg;
-            break;
-        case 1:   /* bold */
-            *curflags = ACF_BOLD;
-            break;
-        case 4:   /* underlined */
-            *curflags = ACF_UNDERLINE;
-            break;
-        case 5:   /* blink */
-            *curflags = ACF_BLINK;
-            break;
-        case 7:   /* inverse */
-            *curflags = ACF_INVERSE;
-            break;
-        case 30: case 31: case 32: case 33:
-        case 34: case 35: case 36: case 37:
-            *curfg = sgrcode-30;
-            break;
-        case 39:   /* ctlseqs.ms: "Set foreground color to default (original)" */
-            *curfg = default_fg;
-            break;
-        case 40: case 41: case 42: case 43:
-        case 44: case 45: case 46: case 47:
-            *curbg = sgrcode-40;
-            break;
+static int sauce_info(char const *path, void const *in, size_t len, struct noansi_buf *out) {
+    struct noansi_sauce sauce;
+    char rest[256];
+    int found = noansi_sauce_parse(in, len, &sauce);
+    size_t n;
+    if(!found) {
+        memset(&sauce, 0, sizeof(sauce));
+        sauce.datalen = len;
+    }
+    clean_field(sauce.title);
+    clean_field(sauce.author);
+    clean_field(sauce.group);
+    clean_field(sauce.date);
+    snprintf(rest, sizeof(rest), "\t%d\t%u\t%u\t%u\t%u\t%zu\t%s\t%s\t%s\t%s\n", found,
+            sauce.datatype, sauce.filetype, sauce.tinfo[0], sauce.tinfo[1], sauce.datalen,
+            sauce.date, sauce.title, sauce.author, sauce.group);
+    n = strlen(path) + strlen(rest);
+    if(out->cap - out->len <= n) {
+        char *nd = realloc(out->data, out->len + n + 1);
+        if(nd == NULL) {
+            return -1;
+        }
+        out->data = nd;
+        out->cap = out->len + n + 1;
+    }
+    out->len += sprintf(out->data + out->len, "%s%s", path, rest);
+    return 0;
+}
 
-        case 8:    /* invisible */
-        case 48:   /* i'm not sure what this is supposed to do.  ECMA-48
-                    * indicates that this is supposed to be used in cases such
-                    * as CSI [ 48 ; 5 ; Ps m, which is supposed to set the bg
-                    * color to Ps.  but this construction doesn't seem to
-                    * work:  Ps is treated as a normal SGR code.  ctlseqs.ms
-                    * says this is only for newer xterm/rxvts, anyway..
-                    */
-        case 53:   /* enable "overline mode" (an apparent misnomer in many cases) */
-        case 55:   /* disable overline mode */
-            break;
-        default:
-            fprintf(stderr, "warning: invalid SGR code %d detected, ignoring\n", 
-                    sgrcode);
-            break;
+/* what ctx's last conversion skipped, as "3 unknown, 1 escape"; NULL if
+ * nothing (or out of memory)
+ */
+static char *skip_summary(noansi_ctx const *ctx) {
+    unsigned long const *skips = noansi_skipped(ctx);
+    char buf[NOANSI_NSKIPS * 32], *p = buf;
+    int i;
+    for(i = 0; i < NOANSI_NSKIPS; i++) {
+        if(skips[i] > 0) {
+            p += sprintf(p, "%s%lu %s", p == buf ? "" : ", ", skips[i], noansi_skip_name(i));
+        }
     }
+    return p == buf ? NULL : strdup(buf);
 }
-static void clear_screen(achar_t screen[NROWS][NCOLS]) {
-    int i, j;
-    for(i = 0; i < NROWS; i++) {
-        for(j = 0; j < NCOLS; j++) {
-            screen[i][j] = default_char;
+/* the line to tell the user about what ctx's last conversion skipped, without
+ * a newline: lenient, everything skip_summary() has; strict, any SGR codes
+ * ignored, which don't fail it.  NULL if nothing (or out of memory)
+ */
+static char *skip_report(noansi_ctx const *ctx, int lenient) {
+    unsigned long sgr = noansi_skipped(ctx)[NOANSI_SKIP_SGR];
+    char buf[NOANSI_NSKIPS * 32 + 16], *summary;
+    if(!lenient) {
+        if(sgr == 0) {
+            return NULL;
         }
+        sprintf(buf, "warning: ignored %lu invalid SGR code%s", sgr, sgr == 1 ? "" : "s");
+        return strdup(buf);
+    }
+    if((summary = skip_summary(ctx)) == NULL) {
+        return NULL;
     }
+    sprintf(buf, "skipped %s", summary);
+    free(summary);
+    return strdup(buf);
 }
-static void read_ansi(FILE *f, achar_t screen[NROWS][NCOLS]) {
-    unsigned char y = 0, savedx = 255, savedy = 255, delta;
-    int c, d;
-    unsigned int x = 0;
-    unsigned int curbg = aBLACK, curfg = aWHITE, curflags = 0, wrapping = 1;
-    while((c = fgetc(f)) != EOF) {
-        int params[512], np = 0, bidx = 0, i, quesflag = 0,
-            semicount = 0;
-        for(int parami = 0; parami < sizeof(params)/sizeof(int); parami++) {
-            params[parami] = -1;
-        }
-        unsigned int curseqlen = 0;
-        char nbuf[5];
-        if(c != 27) {
-            if(c == 0xa) {
-                x = MIN(NROWS-1, x+1);
-                y = 0;
-                continue;
-            } else if(c == 0xd) {
-                y = 0;
-                continue;
-            } else if(c == 0x9 && expandtab == 1) {
-                y = MIN(NCOLS-1, ((y + 8) & 0xf8));
-                continue;
-            } else if(c == 0x1a && includez == 0) {
-                return;
-            }
-            screen[x][y] = AC(c, curfg, curbg, curflags);
-            /* last-line wrapping behavior may need to change */
-            if(wrapping) {
-                y += 1;
-                x = MIN(NROWS-1, x+(y/NCOLS));
-                y %= NCOLS;
-            } else {
-                y = MIN(NCOLS-1,(y+1));
-            }
-            continue;
+
+/* ctx's stats for its last conversion, of path, as a line of JSON (one object,
+ * so a file of them can be read a line at a time); err is why it failed, if
+ * it did.  NULL if out of memory.
+ */
+static void json_string(FILE *f, char const *s) {
+    putc('"', f);
+    for(; *s; s++) {
+        unsigned char c = *s;
+        if(c == '"' || c == '\\') {
+            fprintf(f, "\\%c", c);
+        } else if(c < ' ') {
+            fprintf(f, "\\u%04x", c);
+        } else {
+            putc(c, f);
         }
-        d = fgetc(f);
-        if(d == EOF) {
-            doerror("EOF reached after ESC, aborting\n");
-        } else if(d != '[') {
-            doerror("unknown sequence EOF 0x%d at pos %ld, aborting\n",
-                    d, ftell(f)-1);
-        } else if(d == 0x1a && includez == 0) {
-            return;
+    }
+    putc('"', f);
+}
+static char *stats_json(char const *path, noansi_ctx const *ctx, char const *err) {
+    struct noansi_stats st;
+    unsigned long const *skips = noansi_skipped(ctx);
+    char *line = NULL, final[2] = { 0 };
+    size_t len;
+    int i, first;
+    FILE *f = open_memstream(&line, &len);
+    if(f == NULL) {
+        return NULL;
+    }
+    noansi_stats(ctx, &st);
+    fputs("{\"path\":", f);
+    json_string(f, path);
+    fprintf(f, ",\"ok\":%s", err == NULL ? "true" : "false");
+    if(err != NULL) {
+        /* library messages end in a newline */
+        char *e = strdup(err);
+        if(e != NULL && (len = strlen(e)) > 0 && e[len-1] == '\n') {
+            e[len-1] = 0;
         }
-        while((d = fgetc(f)) != EOF) {
-            curseqlen++;
-            if(curseqlen == MAXSEQLEN) {
-                doerror("reached max sequence length %u at position %ld, aborting\n",
-                        curseqlen, ftell(f)-1);
-            }
-            if(d == 0x1a && includez == 0) {
-                return;
-            }
-            if(isdigit(d)) {
-                if(bidx == sizeof(nbuf)-1) {
-                    doerror("error at pos %ld: number too large, aborting\n", ftell(f)-1);
-                }
-                nbuf[bidx++] = (char)d;
-                continue;
-            }
-            if(bidx > 0 && np < sizeof(params)/sizeof(int)) {
-                nbuf[bidx] = 0;
-                params[np++] = atoi(nbuf);
-                bidx = 0;
-            }
-            switch(d) {
-                case '?':
-                    if(np != 0) {
-                        doerror("invalid sequence CSI ... ; ? at pos %ld\n",
-                                ftell(f)-1);
-                    }
-                    quesflag = 1;
-                    continue;
-                case ';':
-                    semicount++;
-                    continue;
-                case 'm':   /* set graphics (SGR) attributes */
-                    if(quesflag) {
-                        doerror("invalid CSI ? ... m at pos %ld\n",
-                                ftell(f)-1);
-                    }
-                    if(np == 0) {
-                        handle_sgr(0, &curfg, &curbg, &curflags);
-                    } else {
-                        for(i = 0; i < np; i++) {
-                            handle_sgr(params[i], &curfg, &curbg, &curflags);
-                        }
-                    }
-                    break;
-                case 'J':  /* erase parts of the display.  only CSI 2 J handled here */
-                    if(quesflag) {
-                        doerror("invalid CSI ? ... m at pos %ld\n",
-                                ftell(f)-1);
-                    }
-                    if(np != 1) {
-                        doerror("expected 1 param for CSI ... J, got %d\n", 
-                                np);
-                    }
-                    if(params[0] != 2) {
-                        doerror("unknown parameter p = %d for CSI p J\n", np);
-                    }
-                    clear_screen(screen);
-                    x = 0;
-                    y = 0;
-                    break;
-                case 'h':   /* only handling CSI ? 7 h (enable wrapping) */
-                    if(quesflag) {
-                        if(np != 1 || params[0] != 7) {
-                            doerror("expected CSI ? 7 h at position %ld\n",
-                                    ftell(f)-1);
-                        }
-                        wrapping = 1;
-                    } else {
-                        doerror("unknown sequence: CSI %d %d %d h at position %ld\n", 
-                            params[0], params[1], params[2], ftell(f)-1);
-                    }
-                    break;
-                case 'H':  /* CUP (CSI row ; col H): set position */
-                    if(quesflag) {
-                        doerror("invalid CSI ? ... H at pos %ld\n",
-                                ftell(f)-1);
-                    }
-                    if(np == 0) {
-                        x = y = 0;
-                    } else if(np == 1) {
-                        if(semicount == 0) {
-                            x = MAX(0, MIN(params[0]-1, NROWS-1));
-                            y = 0;
-                        } else {
-                            x = 0;
-                            y = MAX(0, MIN(params[0]-1, NCOLS-1));
-                        }
-                    } else if(np == 2) {
-                        x = MAX(0, MIN(params[0]-1, NROWS-1));
-                        y = MAX(0, MIN(params[1]-1, NCOLS-1));
-                    } 
-                    break;
-                case 's':   /* save cursor position */
-                    if(quesflag || np != 0) {
-                        doerror("invalid CSI s form at pos %ld\n",
-                                ftell(f)-1);
-                    }
-                    savedx = x;
-                    savedy = y;
-                    break;
-                case 'u':  /* restore cursor position */
-                    if(quesflag || np != 0) {
-                        doerror("invalid CSI s form at pos %ld\n",
-                                ftell(f)-1);
-                    }
-                    if(savedx == 255 || savedy == 255) {
-                        doerror("CSI u before a CSI s at pos %ld\n",
-                                ftell(f)-1);
-                    }
-                    x = savedx;
-                    y = savedy;
-                    break;
-                case 'A':   /* move up <p> rows */
-                    if(quesflag) {
-                        doerror("invalid CSI ? ... A at pos %ld\n",
-                                ftell(f)-1);
-                    }
-                    if(np > 1) {
-                        doerror("expected 0-1 parameters, got %d for CSI ... A at pos %ld\n",
-                                np, ftell(f)-1);
-                    } else if(np == 1) {
-                        delta = params[0];
-                    } else {
-                        delta = 1;
-                    }
-                    if(delta > x) {
-                        x = 0;
-                    } else {
-                        x -= delta;
-                    }
-                    break;
-                case 'B':   /* move down <p> rows */
-                    if(quesflag) {
-                        doerror("invalid CSI ? ... B at pos %ld\n",
-                                ftell(f)-1);
-                    }
-                    if(np > 1) {
-                        doerror("expected 0-1 parameters, got %d for CSI ... B at pos %ld\n",
-                                np, ftell(f)-1);
-                    } else if(np == 1) {
-                        delta = params[0];
-                    } else {
-                        delta = 1;
-                    }
-                    x = MIN(NROWS-1, (x+delta));
-                    break;
-                case 'C':   /* move forward <p> columns */
-                    if(quesflag) {
-                        doerror("invalid CSI ? ... C at pos %ld\n",
-                                ftell(f)-1);
-                    }
-                    if(np > 1) {
-                        doerror("expected 0-1 parameters, got %d for CSI ... C at pos %ld\n",
-                                np, ftell(f)-1);
-                    } if(np == 1) {
-                        delta = params[0];
-                    } else {
-                        delta = 1;
-                    }
-                    y = MIN(NCOLS-1, (y+delta));
-                    break;
-                case 'D':
-                    if(quesflag) {
-                        doerror("invalid CSI ? ... D at pos %ld\n",
-                                ftell(f)-1);
-                    }
-                    if(np > 1) {
-                        doerror("expected 0-1 parameters, got %d for CSI ... D at pos %ld\n",
-                                np, ftell(f)-1);
-                    } if(np == 1) {
-                        delta = params[0];
-                    } else {
-                        delta = 1;
-                    }
-                    if(delta > y) {
-                        y = 0;
-                    } else {
-                        y -= delta;
-                    }
-                    break;
-                default:
-                    doerror("unknown sequence CSI <params> 0x%x at pos %ld, aborting\n", 
-                            d, ftell(f)-1);
-                    break;
-            }
-            break;
+        fputs(",\"error\":", f);
+        json_string(f, e != NULL ? e : "");
+        free(e);
+    }
+    fprintf(f, ",\"cached\":%s,\"bytes\":%lu,\"outbytes\":%lu,\"cells\":%lu",
+            st.cached ? "true" : "false", st.bytes, st.outbytes, st.cells);
+    fputs(",\"sequences\":{", f);
+    for(i = 0, first = 1; i < NOANSI_NFINALS; i++) {
+        if(st.seqs[i] > 0) {
+            final[0] = 0x40 + i;
+            fputs(first ? "" : ",", f);
+            json_string(f, final);
+            fprintf(f, ":%lu", st.seqs[i]);
+            first = 0;
         }
     }
+    fprintf(f, "},\"sgr\":{\"codes\":%lu,\"ignored\":%lu,\"invalid\":%lu}",
+            st.sgr, st.sgr_ignored, st.sgr_invalid);
+    fprintf(f, ",\"rows\":{\"touched\":%lu,\"max\":%lu,\"clamped\":%lu}",
+            st.rows, st.maxrow, st.clamps);
+    fprintf(f, ",\"colorbytes\":%lu,\"skipped\":{", st.colorbytes);
+    for(i = 0, first = 1; i < NOANSI_NSKIPS; i++) {
+        if(skips[i] > 0) {
+            fprintf(f, "%s\"%s\":%lu", first ? "" : ",", noansi_skip_name(i), skips[i]);
+            first = 0;
+        }
+    }
+    fputs("},\"time\":{", f);
+    for(i = 0; i < NOANSI_NSTAGES; i++) {
+        fprintf(f, "%s\"%s\":{\"wall\":%.6f,\"cpu\":%.6f}", i > 0 ? "," : "",
+                noansi_stage_name(i), st.wall[i], st.cpu[i]);
+    }
+    fputs("}}\n", f);
+    if(fclose(f) != 0) {
+        free(line);
+        return NULL;
+    }
+    return line;
 }
 
-/* a fairly simple algorithm; straight replacement except for some special
- * cases where we tweak the attributes.
- *
- * it's clear there were a lot of compromises made here:  the drawing characters
- * are all demoted to roguelike-style boxes like this:   +---+-----+
- * but this ends up more or less okay.  the real hurt    |   |     |
- * came in deciding what to do for the shading colors    +---+-----+
- * (0xb0-b2, 0xdb-df).  
- * db-df are the trickiest, from my point of view; the approach taken here is 
- * to reverse and use a space instead.  this is fine until we run into the
- * problem of bold colors: there's no way to do bold backgrounds.  for some
- * colors this doesn't matter; for others, we flip the ACF_BGBOLD flag.
+/* convert one file, appending the result to out (or with info, describe its
+ * SAUCE record).  on failure *err is set to the reason and nothing is
+ * appended.  with stats, *stats is set to stats_json() for the conversion,
+ * if it got as far as converting.
  */
-static const unsigned char cp437_to_ascii_map[] = {
-    /* 00 */  ' ', '@', '@', '*',   'x', 'A', '*', '*',
-    /* 08 */  '*', 'o', '*', '6',   'Q', 'f', 'M', '*',
-    /* 10 */  '>', '<', '$', '!',   'P', 'S', '_', '$',
-    /* 18 */  '^', 'v', '>', '<',   '_', '-', 'A', 'v',
-    /* 20 */  ' ', '!', '"', '#',   '$', '%', '&', '\'',
-    /* 28 */  '(', ')', '*', '+',   ',', '-', '.', '/',
-    /* 30 */  '0', '1', '2', '3',   '4', '5', '6', '7',
-    /* 38 */  '8', '9', ':', ';',   '<', '=', '>', '?',
-    /* 40 */  '@', 'A', 'B', 'C',   'D', 'E', 'F', 'G',
-    /* 48 */  'H', 'I', 'J', 'K',   'L', 'M', 'N', 'O',
-    /* 50 */  'P', 'Q', 'R', 'S',   'T', 'U', 'V', 'W',
-    /* 58 */  'X', 'Y', 'Z', '[',   '\\', ']', '^', '_',
-    /* 60 */  '`', 'a', 'b', 'c',   'd', 'e', 'f', 'g',
-    /* 68 */  'h', 'i', 'j', 'k',   'l', 'm', 'n', 'o',
-    /* 70 */  'p', 'q', 'r', 's',   't', 'u', 'v', 'w',
-    /* 78 */  'x', 'y', 'z', '{',   '|', '}', '~', '^',
+static int convert_file(char const *path, noansi_ctx *ctx, int info, struct noansi_buf *out,
+        char const **err, char **stats) {
+    struct input in;
+    int fd = open(path, O_RDONLY), rc;
+    if(fd < 0 || load_input(fd, &in) < 0) {
+        *err = strerror(errno);
+        if(fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    close(fd);
+    if(info) {
+        rc = sauce_info(path, in.data, in.len, out);
+        free_input(&in);
+        if(rc < 0) {
+            *err = "out of memory";
+        }
+        return rc;
+    }
+    rc = noansi_convert(ctx, in.data, in.len, out);
+    free_input(&in);
+    if(rc != NOANSI_OK) {
+        *err = noansi_error(ctx);
+    }
+    if(stats != NULL) {
+        *stats = stats_json(path, ctx, rc != NOANSI_OK ? *err : NULL);
+    }
+    return rc != NOANSI_OK ? -1 : 0;
+}
 
-    /* 80 */  'C', 'u', 'e', 'a',   'a', 'a', 'a', 'c',
-    /* 88 */  'e', 'e', 'e', 'i',   'i', 'i', 'A', 'A',
-    /* 90 */  'E', '%', 'A', 'o',   'o', 'o', 'u', 'u',
-    /* 98 */  'y', 'O', 'U', 'c',   'L', 'Y', 'P', 'f',
-    /* a0 */  'a', 'i', 'o', 'u',   'n', 'N', '~', '^',
-    /* a8 */  '?', '+', '+', 'X',   'K', '!', '<', '>',
-    /* b0 */  '#', '@', '#', '|',   '+', '+', '+', '+',
-    /* b8 */  '+', '+', '|', '+',   '+', '+', '+', '+',
-    /* c0 */  '+', '+', '+', '+',   '-', '+', '+', '+',
-    /* c8 */  '+', '+', '+', '+',   '+', '=', '+', '+',
-    /* d0 */  '+', '+', '+', '+',   '+', '+', '+', '+',
-    /* d8 */  '+', '+', '+', ' ',   'm', '|', '|', '"',
-    /* e0 */  'a', 'B', 'r', 'n',   'E', 'q', 'u', 'r',
-    /* e8 */  'I', '0', '*', 'o',   '*', '0', 'E', 'n',
-    /* f0 */  '=', '+', '>', '<',   'l', 'j', '%', '=',
-    /* f8 */  '*', '.', '.', 'j',   'n', '2', '#', ' ',
+/* batch mode: a list of files (and directories of files) is converted by a
+ * pool of worker threads, each with its own screen.  output goes either to
+ * stdout, in the order the inputs were given, or to one file per input under
+ * outdir.  conversion errors are collected and reported at the end instead of
+ * aborting.
+ */
+#define MAXAHEAD 64     /* finished-but-unwritten jobs allowed in ordered mode */
+struct job {
+    char *path;
+    struct noansi_buf out;  /* rendered output, in ordered mode */
+    char *err;              /* error message, if the conversion failed */
+    char *skips;            /* skip_report() */
+    char *stats;            /* stats_json(), with -S */
+    int done;
 };
-static void cp437_to_ascii(achar_t screen[NROWS][NCOLS]) {
-    int i, j;
-    for(i = 0; i < NROWS; i++) {
-        for(j = 0; j < NCOLS; j++) {
-            achar_t c = screen[i][j], rest = ACREST(c);
-            unsigned char oldchar = ACCHAR(c);
-            if(oldchar == 0x02 || oldchar == 0xb2 || oldchar == 0xdb) {
-                rest ^= ACF_BGBOLD;
-                rest ^= ACF_INVERSE;
-            } else if(oldchar == 0xb1) {
-                rest ^= ACF_BOLD;
-            }
-            screen[i][j] = rest | cp437_to_ascii_map[oldchar];
+struct batch {
+    struct job *jobs;
+    size_t njobs, maxjobs;
+    size_t next, emitted;
+    char const *outdir;
+    int info;               /* describe SAUCE records instead of converting */
+    FILE *stats;            /* where stats go, if anywhere */
+    struct noansi_options opts;
+    noansi_cache *cache;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static void add_job(struct batch *b, char const *path) {
+    if(b->njobs == b->maxjobs) {
+        b->maxjobs = b->maxjobs ? b->maxjobs * 2 : 256;
+        b->jobs = realloc(b->jobs, b->maxjobs * sizeof(struct job));
+        if(b->jobs == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
         }
     }
+    memset(&b->jobs[b->njobs], 0, sizeof(struct job));
+    if((b->jobs[b->njobs].path = strdup(path)) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    b->njobs++;
 }
-/* interpret and remove all attributes. */
-static void normalize(achar_t screen[NROWS][NCOLS]) {
-    int i, j;
-    for(i = 0; i < NROWS; i++) {
-        for(j = 0; j < NCOLS; j++) {
-            achar_t c = screen[i][j];
-            if(c == default_char) {
-                continue;
-            }
-            achar_t flags = ACFLAGS(c);
-            unsigned char ch = ACCHAR(c);
-            unsigned int bgcolor = ACBG(c), fgcolor = ACFG(c), x;
-            if(flags & ACF_BOLD) {
-                fgcolor |= 8;
-            }
-            if(flags & ACF_BGBOLD) {
-                bgcolor |= 8;
+/* add a file, or every file under a directory (sorted, skipping dotfiles);
+ * "-" reads a list of paths from stdin, one per line.
+ */
+static void add_path(struct batch *b, char const *path) {
+    struct stat st;
+    if(strcmp(path, "-") == 0) {
+        char *line = NULL;
+        size_t linesz = 0;
+        ssize_t len;
+        while((len = getline(&line, &linesz, stdin)) != -1) {
+            if(len > 0 && line[len-1] == '\n') {
+                line[--len] = 0;
             }
-            if(flags & ACF_UNDERLINE) {
-                /* nothing right now */
+            if(len > 0) {
+                add_path(b, line);
             }
-            if(flags & ACF_BLINK) {
-                /* nothing right now */
-            } 
-            if(flags & ACF_INVERSE) {
-                x = bgcolor;
-                bgcolor = fgcolor;
-                fgcolor = x;
+        }
+        free(line);
+        return;
+    }
+    if(stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        struct dirent **ents;
+        int n, i;
+        if((n = scandir(path, &ents, NULL, alphasort)) < 0) {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            return;
+        }
+        for(i = 0; i < n; i++) {
+            if(ents[i]->d_name[0] != '.') {
+                char *sub = malloc(strlen(path) + strlen(ents[i]->d_name) + 2);
+                if(sub == NULL) {
+                    fprintf(stderr, "out of memory\n");
+                    exit(1);
+                }
+                sprintf(sub, "%s/%s", path, ents[i]->d_name);
+                add_path(b, sub);
+                free(sub);
             }
-            screen[i][j] = AC(ch, fgcolor, bgcolor, 0);
+            free(ents[i]);
         }
+        free(ents);
+        return;
     }
+    add_job(b, path);
 }
-static void output_mirc(achar_t screen[NROWS][NCOLS], unsigned short colstart, unsigned short colend) {
-    int i, j, lasti = 0;
-    for(i = NROWS-1; i >= 0 && lasti == 0; i--) {
-        for(j = 0; j < NCOLS; j++) {
-            if(screen[i][j] != default_char) {
-                lasti = i+1;
-                break;
+/* outdir/<path>.txt, with path made relative and its . and .. resolved as
+ * far as they go: a .. with nothing left to go up from is dropped, so the
+ * output always lands under outdir.  missing directories are created.
+ */
+static char *output_path(char const *outdir, char const *path) {
+    char *opath, *rel, *p;
+    size_t olen = strlen(outdir), n;
+    if((opath = malloc(olen + strlen(path) + 6)) == NULL) {
+        return NULL;
+    }
+    rel = opath + olen + 1;
+    *rel = 0;
+    while(*path != 0) {
+        n = strcspn(path, "/");
+        if(n == 2 && strncmp(path, "..", 2) == 0) {
+            p = strrchr(rel, '/');
+            *(p != NULL ? p : rel) = 0;
+        } else if(n > 0 && !(n == 1 && path[0] == '.')) {
+            p = rel + strlen(rel);
+            if(p != rel) {
+                *p++ = '/';
             }
+            memcpy(p, path, n);
+            p[n] = 0;
         }
+        path += n + (path[n] == '/');
     }
-    lasti = MIN(colend, i+2);
-    for(i = colstart; i < lasti; i++) {
-        unsigned int curfg = 65535, curbg = 65535; 
-        int stopidx;
-        for(j = NCOLS-1; j >= 0; j--) {
-            achar_t ac = screen[i][j];
-            if(ac != default_char) {
-                break;
-            }
+    memcpy(opath, outdir, olen);
+    opath[olen] = '/';
+    strcat(rel, ".txt");
+    for(p = opath + 1; (p = strchr(p, '/')) != NULL; p++) {
+        *p = 0;
+        mkdir(opath, 0777);
+        *p = '/';
+    }
+    return opath;
+}
+static void *batch_worker(void *arg) {
+    struct batch *b = arg;
+    struct noansi_buf out = { 0 };
+    noansi_ctx *ctx = noansi_new(&b->opts);
+    if(ctx == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    noansi_set_cache(ctx, b->cache);
+    for(;;) {
+        struct job *j;
+        char const *err = NULL;
+        char *opath = NULL, **jstats;
+        int fd;
+        pthread_mutex_lock(&b->lock);
+        while(b->outdir == NULL && b->next < b->njobs
+                && b->next >= b->emitted + MAXAHEAD) {
+            pthread_cond_wait(&b->cond, &b->lock);
         }
-        stopidx = j;
-        for(j = 0; j <= stopidx; j++) {
-            achar_t c = screen[i][j];
-            unsigned char ch = ACCHAR(c);
-            unsigned int bgcolor, fgcolor, fgchange = 0, bgchange = 0;
-            if(c == default_char) {
-                bgcolor = sgr_to_mirc[default_bg];
-                fgcolor = sgr_to_mirc[default_fg];
-            } else {
-                bgcolor = sgr_to_mirc[ACBG(c)];
-                fgcolor = sgr_to_mirc[ACFG(c)];
-            }
-            if(curfg != fgcolor) {
-                curfg = fgcolor;
-                fgchange = 1;
+        if(b->next == b->njobs) {
+            pthread_mutex_unlock(&b->lock);
+            break;
+        }
+        j = &b->jobs[b->next++];
+        pthread_mutex_unlock(&b->lock);
+        jstats = b->stats != NULL && !b->info ? &j->stats : NULL;
+
+        if(b->outdir == NULL) {
+            /* the output goes with the job; run_batch() writes it in order */
+            convert_file(j->path, ctx, b->info, &j->out, &err, jstats);
+        } else if((opath = output_path(b->outdir, j->path)) == NULL) {
+            err = "out of memory";
+        } else if(convert_file(j->path, ctx, b->info, &out, &err, jstats) == 0) {
+            if((fd = open(opath, O_WRONLY|O_CREAT|O_TRUNC, 0666)) < 0
+                    || write_all(fd, out.data, out.len) < 0) {
+                err = strerror(errno);
+                unlink(opath);
             }
-            if(curbg != bgcolor) {
-                curbg = bgcolor;
-                bgchange = 1;
+            if(fd >= 0 && close(fd) != 0 && err == NULL) {
+                err = strerror(errno);
+                unlink(opath);
             }
-            if(fgchange || bgchange) {
-                if(bgchange) {
-                    printf("%c%02d,%02d", 0x3, curfg, curbg);
-                } else {
-                    printf("%c%02d", 0x3, curfg);
-                }
+            out.len = 0;
+        }
+        free(opath);
+        if(err == NULL && !b->info) {
+            j->skips = skip_report(ctx, b->opts.lenient);
+        }
+        if(err != NULL && (j->err = strdup(err)) == NULL) {
+            j->err = "out of memory";
+        }
+        pthread_mutex_lock(&b->lock);
+        j->done = 1;
+        pthread_cond_broadcast(&b->cond);
+        pthread_mutex_unlock(&b->lock);
+    }
+    noansi_buf_free(&out);
+    noansi_free(ctx);
+    return NULL;
+}
+static int run_batch(struct batch *b, int nthreads) {
+    pthread_t *threads;
+    size_t i, failed = 0;
+    int t;
+    if(nthreads < 1) {
+        nthreads = 1;
+    }
+    if((size_t)nthreads > b->njobs) {
+        nthreads = b->njobs ? b->njobs : 1;
+    }
+    if((threads = malloc(nthreads * sizeof(pthread_t))) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    pthread_mutex_init(&b->lock, NULL);
+    pthread_cond_init(&b->cond, NULL);
+    for(t = 0; t < nthreads; t++) {
+        if(pthread_create(&threads[t], NULL, batch_worker, b) != 0) {
+            fprintf(stderr, "couldn't start worker thread\n");
+            exit(1);
+        }
+    }
+    if(b->outdir == NULL) {
+        for(i = 0; i < b->njobs; i++) {
+            struct job *j = &b->jobs[i];
+            pthread_mutex_lock(&b->lock);
+            while(!j->done) {
+                pthread_cond_wait(&b->cond, &b->lock);
             }
-            if(fputc(ch, stdout) == EOF) {
+            pthread_mutex_unlock(&b->lock);
+            if(write_all(STDOUT_FILENO, j->out.data, j->out.len) < 0) {
                 fprintf(stderr, "eof at output; exiting\n");
+                exit(1);
             }
+            noansi_buf_free(&j->out);
+            pthread_mutex_lock(&b->lock);
+            b->emitted = i+1;
+            pthread_cond_broadcast(&b->cond);
+            pthread_mutex_unlock(&b->lock);
         }
-        if(fputc('\n', stdout) == EOF) {
-            fprintf(stderr, "eof at output; exiting\n");
+    }
+    for(t = 0; t < nthreads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+    for(i = 0; i < b->njobs; i++) {
+        if(b->jobs[i].stats != NULL) {
+            fputs(b->jobs[i].stats, b->stats);
+            free(b->jobs[i].stats);
+        }
+        if(b->jobs[i].skips != NULL) {
+            fprintf(stderr, "%s: %s\n", b->jobs[i].path, b->jobs[i].skips);
+            free(b->jobs[i].skips);
+        }
+        if(b->jobs[i].err != NULL) {
+            char const *err = b->jobs[i].err;
+            size_t n = strlen(err);
+            /* library messages end in a newline, strerror()'s don't */
+            fprintf(stderr, "%s: %.*s\n", b->jobs[i].path,
+                    (int)(n > 0 && err[n-1] == '\n' ? n-1 : n), err);
+            failed++;
         }
     }
+    if(failed > 0) {
+        fprintf(stderr, "%zu of %zu files failed\n", failed, b->njobs);
+    }
+    return failed > 0;
+}
+
+/* stats_json() straight to f */
+static void write_stats(FILE *f, char const *path, noansi_ctx const *ctx, char const *err) {
+    char *line = stats_json(path, ctx, err);
+    if(line == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    fputs(line, f);
+    fflush(f);
+    free(line);
 }
-static void check(achar_t screen[NROWS][NCOLS]) {
-    int i, j;
-    for(i = 0; i < NROWS; i++) {
-        for(j = 0; j < NCOLS; j++) {
-            if(screen[i][j] == 0) {
-                doerror("stop %d %d\n", i, j);
+
+/* streaming mode: convert stdin as it arrives, writing out whatever is final
+ * after each read
+ */
+static int run_stream(noansi_ctx *ctx, int lenient, FILE *statsf) {
+    struct noansi_buf out = { 0 };
+    char *buf = malloc(READBLOCK), *skips;
+    ssize_t n;
+    int rc = noansi_stream_begin(ctx);
+    if(buf == NULL) {
+        fprintf(stderr, "%s\n", strerror(errno));
+        exit(1);
+    }
+    while(rc == NOANSI_OK) {
+        if((n = read(STDIN_FILENO, buf, READBLOCK)) < 0) {
+            if(errno == EINTR) {
+                continue;
             }
+            fprintf(stderr, "%s\n", strerror(errno));
+            exit(1);
+        }
+        out.len = 0;
+        rc = n > 0 ? noansi_stream_feed(ctx, buf, n, &out) : noansi_stream_end(ctx, &out);
+        if(write_all(STDOUT_FILENO, out.data, out.len) < 0) {
+            fprintf(stderr, "eof at output; exiting\n");
+            exit(1);
+        }
+        if(n == 0) {
+            break;
         }
     }
+    if(statsf != NULL) {
+        write_stats(statsf, "-", ctx, rc != NOANSI_OK ? noansi_error(ctx) : NULL);
+    }
+    if(rc != NOANSI_OK) {
+        fputs(noansi_error(ctx), stderr);
+        exit(1);
+    }
+    if((skips = skip_report(ctx, lenient)) != NULL) {
+        fprintf(stderr, "%s\n", skips);
+        free(skips);
+    }
+    free(buf);
+    noansi_buf_free(&out);
+    return 0;
 }
 
 void usage(void) {
-    fprintf(stderr, "args: [-tzh] [START-END]\n");
+    fprintf(stderr, "args: [-tzhsmfuikpP] [-e FORMAT] [-a BYTES] [-j N] [-w N] [-C DIR] [-S FILE] [-r ROWS] [-c COLS] [START-END]\n");
+    fprintf(stderr, "      -b [-j N] [-o DIR] [-l START-END] [-C DIR] [-S FILE] [-e FORMAT] [-tzmfuikpP] [-r ROWS] [-c COLS] PATH...\n");
     fprintf(stderr, "      -t: expand tabs to 8 spaces like DOS does\n");
-    fprintf(stderr, "      -z: don't stop reading when an EOF (^Z, 0x1a) is encountered");
+    fprintf(stderr, "      -z: don't stop reading when an EOF (^Z, 0x1a) is encountered\n");
+    fprintf(stderr, "      -m: minimal output: only set the colors that show, in as few bytes\n");
+    fprintf(stderr, "          as possible (mirc formats only)\n");
+    fprintf(stderr, "      -e: output format: mirc (the default; ascii), mirc-utf8, xterm\n");
+    fprintf(stderr, "          (256 colors), truecolor or html; all but mirc have the real\n");
+    fprintf(stderr, "          cp437 glyphs, in utf-8\n");
+    fprintf(stderr, "      -u: use the SAUCE record: leave it out, and take the width from it\n");
+    fprintf(stderr, "      -i: describe the SAUCE record instead of converting: a line of\n");
+    fprintf(stderr, "          path, found (0/1), datatype, filetype, width, height, length\n");
+    fprintf(stderr, "          of the picture, date, title, author and group, tab-separated\n");
+    fprintf(stderr, "      -k: lenient: skip sequences that can't be handled instead of failing,\n");
+    fprintf(stderr, "          and say how many of each kind were skipped\n");
+    fprintf(stderr, "      -p: preview: stop reading once nothing further on can change\n");
+    fprintf(stderr, "          lines START to END; the same output, for less work on big files\n");
+    fprintf(stderr, "      -P: rough preview: stop as soon as the cursor is past END, missing\n");
+    fprintf(stderr, "          anything that would have gone back up\n");
     fprintf(stderr, "      -h: show this text\n");
+    fprintf(stderr, "      -b: batch mode; convert every PATH (a file, a directory of files,\n");
+    fprintf(stderr, "          or - to read paths from stdin) and write the results to\n");
+    fprintf(stderr, "          stdout in order\n");
+    fprintf(stderr, "      -f: print every frame: the screen before each clear (CSI 2 J), then\n");
+    fprintf(stderr, "          the last, instead of only the last\n");
+    fprintf(stderr, "      -a: animation: print every frame as the rows that changed since the\n");
+    fprintf(stderr, "          last, ending frames at clears, at cursor home and every BYTES\n");
+    fprintf(stderr, "          bytes of input (0: only at clears and home)\n");
+    fprintf(stderr, "      -j: use N worker threads (default: one per cpu); without -b, a large\n");
+    fprintf(stderr, "          file is cut at its clears and the pieces parsed in parallel\n");
+    fprintf(stderr, "      -o: in batch mode, write each result to DIR/PATH.txt instead\n");
+    fprintf(stderr, "      -l: lines to display, same as START-END\n");
+    fprintf(stderr, "      -s: streaming mode; write out lines as soon as they're final,\n");
+    fprintf(stderr, "          instead of after reading all of the input\n");
+    fprintf(stderr, "      -w: in streaming mode, how many lines above the cursor it may still\n");
+    fprintf(stderr, "          move back up to (default 25); further up is clamped\n");
+    fprintf(stderr, "      -C: keep renders in (and reuse them from) the cache directory DIR\n");
+    fprintf(stderr, "      -S: write stats for each conversion to FILE (- for stderr), a line\n");
+    fprintf(stderr, "          of JSON each: bytes, cells, sequences by final byte, SGR codes,\n");
+    fprintf(stderr, "          rows, color bytes, what was skipped and the time in each stage\n");
+    fprintf(stderr, "      -r: screen height in rows (default 1024)\n");
+    fprintf(stderr, "      -c: screen width in columns (default 80)\n");
     fprintf(stderr, "\n      START and END are the lines to display; START is inclusive and END is exclusive\n");
 }
 
+static int parse_range(char const *arg, struct noansi_options *opts) {
+    unsigned int nc, ne;
+    if(sscanf(arg, "%u-%u", &nc, &ne) != 2) {
+        usage();
+        fprintf(stderr, "invalid length, expected START-END (0-indexed, START inclusive, END exclusive)\n");
+        return -1;
+    }
+    opts->start = nc;
+    opts->end = ne;
+    return 0;
+}
+
+static int parse_format(char const *arg) {
+    char const *name;
+    int i;
+    for(i = 0; (name = noansi_format_name(i)) != NULL; i++) {
+        if(strcmp(arg, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+#define CACHEMEM (64 << 20)     /* renders kept in memory with -C, in bytes */
 extern int optind;
+extern char *optarg;
 int main(int argc, char *argv[]) {
-    unsigned short colstart = 0, colend = NCOLS;
-    int ch;
-    while((ch = getopt(argc, argv, "thz")) != -1) {
+    struct noansi_options opts;
+    int ch, batch = 0, stream = 0, info = 0, nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    char const *outdir = NULL, *cachedir = NULL, *statspath = NULL;
+    noansi_cache *cache = NULL;
+    FILE *statsf = NULL;
+    noansi_options_init(&opts);
+    while((ch = getopt(argc, argv, "thzbsmfuikpPa:e:j:o:l:w:C:S:r:c:")) != -1) {
         switch (ch) {
             case 't':
-                expandtab = 1;
+                opts.expandtab = 1;
                 break;
             case 'z':
-                includez = 1;
+                opts.includez = 1;
+                break;
+            case 'b':
+                batch = 1;
+                break;
+            case 'm':
+                opts.minimal = 1;
+                break;
+            case 'f':
+                opts.frames = 1;
+                break;
+            case 'e':
+                if((opts.format = parse_format(optarg)) < 0) {
+                    usage();
+                    fprintf(stderr, "unknown format %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'a':
+                opts.animate = 1;
+                opts.cadence = atoi(optarg);
+                break;
+            case 'u':
+                opts.sauce = 1;
+                break;
+            case 'i':
+                info = 1;
+                break;
+            case 'k':
+                opts.lenient = 1;
+                break;
+            case 'p':
+                opts.preview = NOANSI_PREVIEW_EXACT;
+                break;
+            case 'P':
+                opts.preview = NOANSI_PREVIEW_ROUGH;
+                break;
+            case 's':
+                stream = 1;
+                break;
+            case 'w':
+                opts.window = atoi(optarg);
+                break;
+            case 'j':
+                nthreads = atoi(optarg);
+                break;
+            case 'o':
+                outdir = optarg;
+                break;
+            case 'l':
+                if(parse_range(optarg, &opts) < 0) {
+                    exit(1);
+                }
+                break;
+            case 'C':
+                cachedir = optarg;
+                break;
+            case 'S':
+                statspath = optarg;
+                opts.stats = 1;
+                break;
+            case 'r':
+                opts.rows = atoi(optarg);
+                break;
+            case 'c':
+                opts.cols = atoi(optarg);
                 break;
             case 'h':
              default:
@@ -573,21 +773,95 @@ int main(int argc, char *argv[]) {
     }
     argc -= optind;
     argv += optind;
-    if(argc > 0) {
-        unsigned short nc, ne;
-        if(sscanf(argv[0], "%hu-%hu", &nc, &ne) != 2) {
-            usage();
-            doerror("invalid length, expected START-END (0-indexed, START inclusive, END exclusive)\n");
-        } else {
-            colstart = nc;
-            colend = ne;
+    if(!batch && argc > 0 && parse_range(argv[0], &opts) < 0) {
+        exit(1);
+    }
+    /* batch mode has its threads convert files; one alone gets them all */
+    if(!batch && nthreads > 0) {
+        opts.threads = nthreads;
+    }
+    noansi_ctx *ctx = noansi_new(&opts);
+    if(ctx == NULL) {
+        usage();
+        fprintf(stderr, "invalid screen size %ux%u\n", opts.cols, opts.rows);
+        exit(1);
+    }
+    if(statspath != NULL) {
+        statsf = strcmp(statspath, "-") == 0 ? stderr : fopen(statspath, "w");
+        if(statsf == NULL) {
+            fprintf(stderr, "%s: %s\n", statspath, strerror(errno));
+            exit(1);
+        }
+    }
+    if(cachedir != NULL) {
+        if(mkdir(cachedir, 0777) < 0 && errno != EEXIST) {
+            fprintf(stderr, "%s: %s\n", cachedir, strerror(errno));
+            exit(1);
         }
+        if((cache = noansi_cache_new(CACHEMEM, cachedir)) == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        noansi_set_cache(ctx, cache);
+    }
+    if(batch) {
+        struct batch b;
+        int i, rc;
+        noansi_free(ctx);
+        memset(&b, 0, sizeof(b));
+        b.outdir = outdir;
+        b.info = info;
+        b.stats = statsf;
+        b.opts = opts;
+        b.cache = cache;
+        for(i = 0; i < argc; i++) {
+            add_path(&b, argv[i]);
+        }
+        rc = run_batch(&b, nthreads);
+        noansi_cache_free(cache);
+        if(statsf != NULL && fclose(statsf) != 0) {
+            fprintf(stderr, "%s: %s\n", statspath, strerror(errno));
+            rc = 1;
+        }
+        return rc;
+    }
+    if(stream) {
+        run_stream(ctx, opts.lenient, statsf);
+        noansi_free(ctx);
+        return 0;
+    }
+    struct noansi_buf out = { 0 };
+    struct input in;
+    char *skips;
+    if(load_input(STDIN_FILENO, &in) < 0) {
+        fprintf(stderr, "%s\n", strerror(errno));
+        exit(1);
+    }
+    if(info) {
+        if(sauce_info("-", in.data, in.len, &out) < 0) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    } else if(noansi_convert(ctx, in.data, in.len, &out) != NOANSI_OK) {
+        if(statsf != NULL) {
+            write_stats(statsf, "-", ctx, noansi_error(ctx));
+        }
+        fputs(noansi_error(ctx), stderr);
+        exit(1);
+    } else if(statsf != NULL) {
+        write_stats(statsf, "-", ctx, NULL);
+    }
+    if(!info && (skips = skip_report(ctx, opts.lenient)) != NULL) {
+        fprintf(stderr, "%s\n", skips);
+        free(skips);
+    }
+    free_input(&in);
+    if(write_all(STDOUT_FILENO, out.data, out.len) < 0) {
+        fprintf(stderr, "eof at output; exiting\n");
+        exit(1);
     }
-    achar_t screen[NROWS][NCOLS];
-    clear_screen(screen);
-    read_ansi(stdin, screen);
-    cp437_to_ascii(screen);
-    normalize(screen);
-    output_mirc(screen, colstart, colend);
+    noansi_buf_free(&out);
+    noansi_free(ctx);
+    noansi_cache_free(cache);
     return 0;
 }
@@ -0,0 +1,237 @@
+#ifndef NOANSI_H
+#define NOANSI_H
+
+#include <stddef.h>
+
+/* libnoansi: the cp437+dosansi -> ascii+mirc color translator behind noansi,
+ * for programs that want to convert without running it.
+ *
+ * a noansi_ctx holds the options and the screen, and can be reused for any
+ * number of conversions (that's the point: the screen's memory is kept).  a
+ * context must only be used by one thread at a time; use one per thread.
+ *
+ *     struct noansi_options opts;
+ *     struct noansi_buf out = { 0 };
+ *     noansi_options_init(&opts);
+ *     noansi_ctx *ctx = noansi_new(&opts);
+ *     if(noansi_convert(ctx, data, len, &out) != NOANSI_OK)
+ *         fprintf(stderr, "%s", noansi_error(ctx));
+ *     ...
+ *     noansi_buf_free(&out);
+ *     noansi_free(ctx);
+ */
+
+enum noansi_status {
+    NOANSI_OK = 0,
+    NOANSI_ESYNTAX = -1,    /* the input has a sequence we can't handle */
+    NOANSI_ENOMEM = -2,
+    NOANSI_EINVAL = -3,     /* bad options */
+};
+
+/* output formats.  all but the first show cp437 as it really looks, in
+ * utf-8.  html lines are runs of <span>s, meant to go in a <pre>.
+ */
+enum noansi_format {
+    NOANSI_MIRC = 0,        /* ascii and mirc color codes */
+    NOANSI_MIRC_UTF8,       /* mirc color codes */
+    NOANSI_XTERM,           /* SGR sequences, 256-color */
+    NOANSI_TRUECOLOR,       /* SGR sequences, 24-bit VGA colors */
+    NOANSI_HTML,            /* <span>s styled with the VGA colors */
+};
+/* a format's name, as noansi -e takes it, e.g. "mirc-utf8"; NULL if there's
+ * no such format
+ */
+char const *noansi_format_name(int format);
+
+struct noansi_options {
+    int expandtab;          /* expand tabs to 8 spaces like DOS does */
+    int includez;           /* don't stop at an EOF (^Z, 0x1a) */
+    unsigned int rows;      /* screen size; the cursor is clamped to it */
+    unsigned int cols;
+    unsigned int start;     /* lines to output; start inclusive, end exclusive */
+    unsigned int end;
+    unsigned int window;    /* streaming: how far up the cursor may still move */
+    int format;             /* one of the noansi_format */
+    int minimal;            /* mirc: set colors in as few bytes as possible */
+    int frames;             /* print the screen before every clear, not just the last */
+    unsigned int threads;   /* threads to parse a large input with, cut at its clears */
+    int animate;            /* print every frame as the rows that changed */
+    unsigned int cadence;   /* animate: also end a frame every this many bytes */
+    int sauce;              /* size the screen from a SAUCE record, and skip it */
+    int lenient;            /* skip sequences we can't handle instead of failing */
+    int stats;              /* time the stages and count color bytes, for noansi_stats() */
+    int preview;            /* stop parsing once lines start to end are done (noansi_preview) */
+};
+
+/* opts.preview, for thumbnails of big files: a conversion of one screen (not
+ * of frames or animations) can stop parsing once the cursor, and any position
+ * saved, has gone below line end.  EXACT only stops if a quick look at the
+ * rest of the input shows nothing in it could come back up to the lines or
+ * fail the conversion, so the result is the same; the counts are of what was
+ * parsed.  ROUGH stops there regardless, as if the input ended: a later move
+ * up or clear that would have changed the lines is missed, and so are later
+ * errors.  either way it's parsed in one thread.  the cache holds whole
+ * renders, so a conversion that goes through it doesn't stop.
+ */
+enum noansi_preview {
+    NOANSI_PREVIEW_OFF = 0,
+    NOANSI_PREVIEW_EXACT,
+    NOANSI_PREVIEW_ROUGH,
+};
+
+/* output goes here.  it belongs to the caller, who can start it out empty
+ * (all zero); conversions append to it and grow it with realloc as needed.
+ */
+struct noansi_buf {
+    char *data;
+    size_t len, cap;
+};
+
+typedef struct noansi_ctx noansi_ctx;
+
+/* the defaults: no tab expansion, stop at ^Z, 1024x80, lines 0-80, a
+ * 25-line streaming window, mirc with plain colors, the last frame only, one
+ * thread, no animation, SAUCE records ignored, strict, no timing, the whole
+ * input parsed
+ */
+void noansi_options_init(struct noansi_options *opts);
+
+/* NULL if out of memory or the options are invalid */
+noansi_ctx *noansi_new(struct noansi_options const *opts);
+void noansi_free(noansi_ctx *ctx);
+int noansi_set_options(noansi_ctx *ctx, struct noansi_options const *opts);
+
+/* convert in[0..inlen) and append the result to out.  returns NOANSI_OK or
+ * one of the errors above, in which case nothing is appended and
+ * noansi_error() says what went wrong.
+ *
+ * with opts.frames the result is every frame in turn, lines start to end of
+ * each.  with opts.threads > 1, a large input is cut at its clears (CSI 2 J)
+ * and the pieces parsed at once; the result is the same either way.
+ *
+ * with opts.animate the result is instead every frame as a diff against the
+ * one before: a line "frame N OFFSET", then for each row that changed, its
+ * number, a space and its new contents.  a frame ends before a clear, when
+ * the cursor goes home, every opts.cadence bytes of input (if not 0) and at
+ * the end; frames in which nothing between lines start and end changed are
+ * left out.  the cache isn't used for animations.
+ *
+ * with opts.sauce, an input ending in a SAUCE record is converted without
+ * it (or its comments), as wide as the record says if it's character art;
+ * its height only sizes the screen up front, since it's often wrong.
+ */
+int noansi_convert(noansi_ctx *ctx, void const *in, size_t inlen, struct noansi_buf *out);
+char const *noansi_error(noansi_ctx const *ctx);
+
+/* what a conversion couldn't handle, by kind.  strict (the default), any of
+ * these but an SGR code is NOANSI_ESYNTAX; with opts.lenient they're counted
+ * and skipped: a bad CSI sequence is dropped up to its final byte, a bad
+ * escape with the byte after it.  unknown SGR codes are only ever counted.
+ */
+enum noansi_skip {
+    NOANSI_SKIP_ESCAPE,     /* ESC followed by something other than [ */
+    NOANSI_SKIP_LENGTH,     /* a sequence too long to hold */
+    NOANSI_SKIP_NUMBER,     /* a parameter of more than 4 digits */
+    NOANSI_SKIP_FORM,       /* a known sequence in a form we don't handle */
+    NOANSI_SKIP_RESTORE,    /* CSI u with no position saved */
+    NOANSI_SKIP_UNKNOWN,    /* a CSI sequence we don't know at all */
+    NOANSI_SKIP_SGR,        /* an SGR code we don't know */
+    NOANSI_SKIP_EOF,        /* the input ends in an escape */
+    NOANSI_NSKIPS
+};
+/* NOANSI_NSKIPS counts for the last conversion, or the stream so far */
+unsigned long const *noansi_skipped(noansi_ctx const *ctx);
+/* a short name for a kind, e.g. "unknown"; NULL if there's no such kind */
+char const *noansi_skip_name(int kind);
+
+/* what the last conversion, or the stream so far, did and where the time
+ * went, to find the inputs that are pathological.  everything is counted
+ * always but the color bytes and the times, which cost something and are
+ * only kept with opts.stats.  a cache hit parses nothing, so it only counts
+ * bytes, and has the render's noansi_skipped(); a failed conversion counts
+ * up to where it failed.
+ */
+enum noansi_stage {
+    NOANSI_STAGE_CACHE,     /* hashing the input, finding, loading, storing, slicing */
+    NOANSI_STAGE_PARSE,     /* onto the screen; an animation's frames are output here too */
+    NOANSI_STAGE_OUTPUT,    /* the screen into the output format */
+    NOANSI_NSTAGES
+};
+#define NOANSI_NFINALS 63   /* CSI final bytes, 0x40-0x7e */
+struct noansi_stats {
+    unsigned long bytes;            /* input */
+    unsigned long outbytes;
+    unsigned long cells;            /* characters written to the screen */
+    unsigned long seqs[NOANSI_NFINALS]; /* CSI sequences by final byte, from 0x40 */
+    unsigned long sgr;              /* SGR codes, all told */
+    unsigned long sgr_ignored;      /* known to do nothing: 8, 48, 53, 55 */
+    unsigned long sgr_invalid;      /* not known at all */
+    unsigned long rows;             /* rows written to, again if erased whole first */
+    unsigned long maxrow;           /* the lowest line the cursor got to */
+    unsigned long clamps;           /* moves down cut short by the bottom of the screen */
+    unsigned long colorbytes;       /* of the output, color codes and markup */
+    int cached;                     /* a cache hit */
+    double wall[NOANSI_NSTAGES];    /* seconds in each stage */
+    double cpu[NOANSI_NSTAGES];     /* cpu seconds, in all threads */
+};
+void noansi_stats(noansi_ctx const *ctx, struct noansi_stats *stats);
+/* a short name for a stage, e.g. "parse"; NULL if there's no such stage */
+char const *noansi_stage_name(int stage);
+
+/* streaming: convert input that arrives in pieces, without holding all of
+ * it.  output comes out as soon as it's final, i.e. once the cursor is more
+ * than opts.window rows below it; cursor movement that reaches further up
+ * than that is clamped, which is where the result can differ from
+ * noansi_convert()'s (with window >= rows it can't).  a clear screen (CSI 2 J)
+ * prints the page so far and starts the next one at line 0.
+ *
+ * feed appends whatever became final to out; end flushes the rest.  after
+ * an error the stream is dead until the next begin.
+ */
+int noansi_stream_begin(noansi_ctx *ctx);
+int noansi_stream_feed(noansi_ctx *ctx, void const *in, size_t inlen, struct noansi_buf *out);
+int noansi_stream_end(noansi_ctx *ctx, struct noansi_buf *out);
+
+void noansi_buf_free(struct noansi_buf *buf);
+
+/* SAUCE: the metadata record at the end of most art.  the strings are cp437,
+ * with their padding taken off.
+ */
+struct noansi_sauce {
+    char title[36], author[21], group[21];
+    char date[9];               /* CCYYMMDD */
+    char font[23];
+    unsigned int datatype, filetype;
+    unsigned int tinfo[4];      /* for character art, width and height first */
+    unsigned int flags;
+    unsigned long filesize;     /* as recorded, which is often wrong */
+    size_t datalen;             /* the picture: everything before the metadata */
+    char const *comments;       /* ncomments lines of 64 bytes; points into the input */
+    unsigned int ncomments;
+};
+/* 1 and *sauce filled in if in ends in a SAUCE record, 0 if it doesn't */
+int noansi_sauce_parse(void const *in, size_t inlen, struct noansi_sauce *sauce);
+/* the size of the picture in characters, if the record is for character art
+ * and says; 0 where it doesn't
+ */
+void noansi_sauce_size(struct noansi_sauce const *sauce, unsigned int *width,
+        unsigned int *height);
+
+/* a render cache, for converting the same files over and over.  it's keyed on
+ * a hash of the input and the options that shape the screen (tabs, ^Z, size,
+ * lenient mode), and holds the whole render, so a different range of lines of
+ * the same input is a hit too.  entries are kept in memory up to maxbytes
+ * and, if dir isn't NULL, as files in dir, which must exist.
+ *
+ * a cache can be shared by any number of contexts, in any threads; it must
+ * outlive them, or at least their conversions.  streaming doesn't use it.
+ */
+typedef struct noansi_cache noansi_cache;
+
+/* NULL if out of memory */
+noansi_cache *noansi_cache_new(size_t maxbytes, char const *dir);
+void noansi_cache_free(noansi_cache *cache);
+/* have ctx's conversions go through cache; NULL to stop */
+void noansi_set_cache(noansi_ctx *ctx, noansi_cache *cache);
+
+#endif
@@ -0,0 +1,514 @@
+#include <time.h>
+
+#include "libnoansi.c"
+
+/* noansibench: throughput of the translator, stage by stage, on synthetic
+ * inputs
+ *
+ * the inputs are generated from a fixed seed, so they're the same on every
+ * run and every machine: sgr-dense color art, cursor-positioning art, plain
+ * text, a tall scroller and a CSI 2 J redraw loop.  each is timed through
+ * every stage of the pipeline (parsing, cp437_to_ascii(), normalize(), the
+ * row kernel that does both at once, and the mirc output) and end to end,
+ * best of a few runs, and every render is checked against a golden digest
+ * so that a faster version can't also be a different one.  files can be
+ * timed the same way, unchecked, to compare the parser on real art.
+ *
+ * first, though, every vector row kernel the cpu has is checked against the
+ * scalar one, bit for bit, on random cells at the widths and alignments that
+ * exercise their tails, which the renders hardly do.
+ *
+ * this includes libnoansi.c itself, to get at the stages, so it's built
+ * alone:
+ *
+ * build: cc -O2 -pthread -o noansibench noansibench.c
+ *
+ * run noansibench -h for usage
+ */
+
+/* xorshift64*: small, fast and the same everywhere */
+static u_int64_t rng;
+static unsigned int rnd(unsigned int n) {
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return (unsigned int)((rng * 0x2545f4914f6cdd1dULL) >> 32) % n;
+}
+
+static void put(struct noansi_buf *b, char const *s, size_t n) {
+    if(buf_reserve(b, n) < 0) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+}
+static void putf(struct noansi_buf *b, char const *fmt, ...) {
+    char s[64];
+    va_list ap;
+    int n;
+    va_start(ap, fmt);
+    n = vsnprintf(s, sizeof(s), fmt, ap);
+    va_end(ap);
+    put(b, s, n);
+}
+static void putch(struct noansi_buf *b, unsigned char c) {
+    put(b, (char const *)&c, 1);
+}
+/* all of path, appended to b */
+static void load(struct noansi_buf *b, char const *path) {
+    char chunk[65536];
+    size_t n;
+    FILE *f = fopen(path, "rb");
+    if(f == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    while((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        put(b, chunk, n);
+    }
+    if(ferror(f)) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    fclose(f);
+}
+/* a character for art: mostly shading and blocks, some line drawing */
+static unsigned char artch(void) {
+    static const unsigned char art[] = {
+        ' ', ' ', ' ', 0xb0, 0xb1, 0xb2, 0xdb, 0xdc, 0xdd, 0xde, 0xdf,
+        0xc4, 0xcd, 0xb3, 0xba, 0xda, 0xbf, 0xc0, 0xd9, 0xfe, 0xf9, '.', ':',
+    };
+    return art[rnd(sizeof(art))];
+}
+static unsigned char textch(void) {
+    return rnd(6) == 0 ? ' ' : 'a' + rnd(26);
+}
+/* an SGR with one to three of the codes the parser knows */
+static void put_sgr(struct noansi_buf *b) {
+    static const int codes[] = { 0, 1, 5, 7, 30, 31, 32, 33, 34, 35, 36, 37,
+        40, 41, 42, 43, 44, 45, 46, 47 };
+    unsigned int i, n = 1 + rnd(3);
+    put(b, "\x1b[", 2);
+    for(i = 0; i < n; i++) {
+        putf(b, i ? ";%d" : "%d", codes[rnd(sizeof(codes) / sizeof(codes[0]))]);
+    }
+    putch(b, 'm');
+}
+
+/* the generators append about size bytes of input to b.  the art ones draw
+ * pages of PAGELINES lines and go back to the top for the next, the way a
+ * file of several pictures would be drawn over the same screen.
+ */
+#define PAGELINES 1000
+static void gen_sgr(struct noansi_buf *b, size_t size) {
+    unsigned int line = 0, j;
+    while(b->len < size) {
+        for(j = 0; j < 79; j++) {
+            if(rnd(3) == 0) {
+                put_sgr(b);
+            }
+            putch(b, artch());
+        }
+        put(b, "\r\n", 2);
+        if(++line % PAGELINES == 0) {
+            put(b, "\x1b[H", 3);
+        }
+    }
+}
+static void gen_cup(struct noansi_buf *b, size_t size) {
+    static const char moves[] = "ABCD";
+    unsigned int j, n;
+    while(b->len < size) {
+        switch(rnd(4)) {
+            case 0: case 1:
+                putf(b, "\x1b[%u;%uH", 1 + rnd(PAGELINES), 1 + rnd(80));
+                break;
+            case 2:
+                putf(b, "\x1b[%u%c", 1 + rnd(8), moves[rnd(4)]);
+                break;
+            case 3:
+                put(b, rnd(2) ? "\x1b[s" : "\x1b[u", 3);
+                break;
+        }
+        if(rnd(2) == 0) {
+            put_sgr(b);
+        }
+        for(j = 0, n = 1 + rnd(8); j < n; j++) {
+            putch(b, artch());
+        }
+    }
+}
+static void gen_plain(struct noansi_buf *b, size_t size) {
+    unsigned int line = 0, j, n;
+    while(b->len < size) {
+        for(j = 0, n = rnd(80); j < n; j++) {
+            putch(b, textch());
+        }
+        put(b, "\r\n", 2);
+        if(++line % PAGELINES == 0) {
+            put(b, "\x1b[H", 3);
+        }
+    }
+}
+/* never goes back up: every line is a new row of a very tall screen */
+static void gen_tall(struct noansi_buf *b, size_t size) {
+    unsigned int j, n;
+    while(b->len < size) {
+        if(rnd(4) == 0) {
+            put_sgr(b);
+        }
+        for(j = 0, n = rnd(80); j < n; j++) {
+            putch(b, rnd(4) ? textch() : artch());
+        }
+        put(b, "\r\n", 2);
+    }
+}
+/* an animation: a 25-line frame, clear, the next frame, ... */
+static void gen_redraw(struct noansi_buf *b, size_t size) {
+    unsigned int i, j;
+    while(b->len < size) {
+        put(b, "\x1b[2J", 4);
+        for(i = 0; i < 25; i++) {
+            putf(b, "\x1b[%u;1H", i + 1);
+            for(j = 0; j < 80; j++) {
+                if(rnd(8) == 0) {
+                    put_sgr(b);
+                }
+                putch(b, artch());
+            }
+        }
+    }
+}
+
+/* golden digests of the renders at the default size; regenerate them with
+ * -g, and only when the output is meant to change
+ */
+static const struct corpus {
+    char const *name;
+    void (*gen)(struct noansi_buf *, size_t);
+    unsigned int rows;
+    char const *golden;
+} corpora[] = {
+    { "sgr",    gen_sgr,    NROWS,  "d93f8b37ad3d72a6fe4952db3071908a" },
+    { "cup",    gen_cup,    NROWS,  "f08135dd3e439bc06596841f145a008a" },
+    { "plain",  gen_plain,  NROWS,  "4fe3e0ec5671291da1144d091ac13144" },
+    { "tall",   gen_tall,   262144, "02856dc66b170dee61438200351fc58d" },
+    { "redraw", gen_redraw, NROWS,  "7e179e371300c66023e3e9616643bb08" },
+};
+#define NCORPORA (sizeof(corpora) / sizeof(corpora[0]))
+#define DEFSIZE (4 << 20)
+#define SEED 0x6e6f616e7369ULL
+
+/* every vector kernel against xlat_row_scalar(), with both tables: random
+ * cells (any bits at all, so every flag combination comes up), each width up
+ * to a few vectors and some around the usual and widest rows, at every
+ * alignment of src and dst.  returns 0 if they all match, and none writes
+ * before or past its row; otherwise says where each first went wrong.
+ */
+#define GUARD 16
+static int check_kernels(void) {
+    int bad = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    static const unsigned int widths[] = { 63, 64, 65, 79, 80, 81, 127, 128, 129,
+        255, 256, 257, MAXCOLS - 17, MAXCOLS - 1, MAXCOLS };
+    static achar_t src[MAXCOLS + 4];
+    static cell_t want[MAXCOLS], got[MAXCOLS + 4 + GUARD];
+    struct {
+        char const *name;
+        void (*row)(cell_t *, achar_t const *, unsigned int, achar_t const *);
+        int have;
+    } kernels[] = {
+        { "sse2", xlat_row_sse2, __builtin_cpu_supports("sse2") },
+        { "avx2", xlat_row_avx2, __builtin_cpu_supports("avx2") },
+    };
+    achar_t const *tabs[] = { xlat_tab, glyph_tab };
+    unsigned int k, t, w, n, off, i;
+    int wrong;
+    rng = SEED;
+    for(k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        if(!kernels[k].have) {
+            fprintf(stderr, "%s kernel: not on this cpu, unchecked\n", kernels[k].name);
+            continue;
+        }
+        wrong = 0;
+        for(t = 0; t < 2 && !wrong; t++) {
+            for(w = 0; w < 40 + sizeof(widths) / sizeof(widths[0]) && !wrong; w++) {
+                n = w < 40 ? w : widths[w - 40];
+                for(off = 0; off < 4 && !wrong; off++) {
+                    for(i = 0; i < n; i++) {
+                        src[off + i] = (achar_t)rnd(1 << 16) << 16 | rnd(1 << 16);
+                    }
+                    xlat_row_scalar(want, src + off, n, tabs[t]);
+                    memset(got, 0xa5, sizeof(got));
+                    kernels[k].row(got + off, src + off, n, tabs[t]);
+                    for(i = 0; i < n && got[off + i] == want[i]; i++)
+                        ;
+                    if(i < n) {
+                        fprintf(stderr, "%s kernel: cell %u of %u (offset %u) is %04x, "
+                                "not %04x\n", kernels[k].name, i, n, off, got[off + i],
+                                want[i]);
+                        wrong = 1;
+                    }
+                    for(i = 0; i < off + n + GUARD && (i - off < n || got[i] == 0xa5a5); i++)
+                        ;
+                    if(i < off + n + GUARD) {
+                        fprintf(stderr, "%s kernel: writes outside a row of %u (offset %u)\n",
+                                kernels[k].name, n, off);
+                        wrong = 1;
+                    }
+                }
+            }
+        }
+        bad |= wrong;
+    }
+#endif
+    return bad;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+static void report(char const *corpus, char const *stage, double t, size_t bytes,
+        size_t cells) {
+    printf("%-8s %-10s %9.3f ms", corpus, stage, t * 1e3);
+    if(bytes) {
+        printf(" %9.1f MB/s", bytes / t / 1e6);
+    } else {
+        printf(" %14s", "");
+    }
+    if(cells) {
+        printf(" %9.1f Mcells/s", cells / t / 1e6);
+    }
+    printf("\n");
+}
+static void die(noansi_ctx *ctx, char const *what) {
+    fprintf(stderr, "%s: %s", what, noansi_error(ctx));
+    exit(1);
+}
+
+/* time each stage of c on in, best of reps; returns 0 if its render matches
+ * the golden digest (or there's nothing to check it against)
+ */
+static int bench(struct corpus const *c, struct noansi_buf const *in, int reps, int check,
+        int golden) {
+    struct noansi_options opts;
+    struct noansi_buf out = { 0 };
+    noansi_ctx *ctx;
+    achar_t *ref = NULL;
+    cell_t *kern = NULL;
+    double best[6] = { 1e9, 1e9, 1e9, 1e9, 1e9, 1e9 }, t;
+    size_t cells = 0, outlen = 0, n = 0;
+    unsigned int i, x;
+    u_int64_t digest[2];
+    char hex[33];
+    int r, bad = 0;
+
+    noansi_options_init(&opts);
+    opts.rows = c->rows;
+    opts.end = UINT_MAX;
+    if((ctx = noansi_new(&opts)) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for(r = 0; r < reps; r++) {
+        /* parsing alone */
+        reset(ctx);
+        t = now();
+        if(read_ansi(ctx, (unsigned char const *)in->data, in->len) != NOANSI_OK
+                || read_ansi_end(ctx) != NOANSI_OK) {
+            die(ctx, c->name);
+        }
+        best[0] = MIN(best[0], now() - t);
+        if(ref == NULL) {
+            for(x = 0; x < ctx->screen.used; x++) {
+                cells += ctx->screen.lens[x];
+            }
+            ref = malloc(MAX(cells, 1) * sizeof(achar_t));
+            kern = malloc(MAX(cells, 1) * sizeof(cell_t));
+            if(ref == NULL || kern == NULL) {
+                fprintf(stderr, "out of memory\n");
+                exit(1);
+            }
+        }
+
+        /* the per-cell steps, one at a time, then the row kernel */
+        t = now();
+        for(x = 0, n = 0; x < ctx->screen.used; x++) {
+            achar_t const *row = screen_peek(&ctx->screen, x);
+            for(i = 0; row != NULL && i < ctx->screen.lens[x]; i++) {
+                ref[n++] = cp437_to_ascii(row[i]);
+            }
+        }
+        best[1] = MIN(best[1], now() - t);
+        t = now();
+        for(i = 0; i < n; i++) {
+            ref[i] = normalize(ref[i]);
+        }
+        best[2] = MIN(best[2], now() - t);
+        t = now();
+        for(x = 0, n = 0; x < ctx->screen.used; x++) {
+            achar_t const *row = screen_peek(&ctx->screen, x);
+            if(row != NULL) {
+                xlat_row(kern + n, row, ctx->screen.lens[x], xlat_tab);
+                n += ctx->screen.lens[x];
+            }
+        }
+        best[3] = MIN(best[3], now() - t);
+        for(i = 0; r == 0 && i < n && kern[i] == (cell_t)ref[i]; i++)
+            ;
+        if(r == 0 && i < n) {
+            fprintf(stderr, "%s: the row kernel doesn't match cp437_to_ascii() + normalize()\n",
+                    c->name);
+            bad = 1;
+        }
+
+        /* the output pass, from the same screen */
+        out.len = 0;
+        t = now();
+        if(output_rows(ctx, &out, 0, MAX(ctx->screen.used, 1)) != NOANSI_OK) {
+            die(ctx, c->name);
+        }
+        best[4] = MIN(best[4], now() - t);
+
+        /* and everything, as a caller sees it */
+        out.len = 0;
+        t = now();
+        if(noansi_convert(ctx, in->data, in->len, &out) != NOANSI_OK) {
+            die(ctx, c->name);
+        }
+        best[5] = MIN(best[5], now() - t);
+        outlen = out.len;
+    }
+
+    hash128(out.data, out.len, 0, digest);
+    snprintf(hex, sizeof(hex), "%016llx%016llx", (unsigned long long)digest[0],
+            (unsigned long long)digest[1]);
+    if(golden) {
+        printf("    { \"%s\", ..., \"%s\" },\n", c->name, hex);
+    } else {
+        printf("%s: %zu bytes in, %zu cells, %zu bytes out\n", c->name, in->len, cells,
+                outlen);
+        report(c->name, "parse", best[0], in->len, 0);
+        report(c->name, "cp437", best[1], 0, cells);
+        report(c->name, "normalize", best[2], 0, cells);
+        report(c->name, "xlat_row", best[3], 0, cells);
+        report(c->name, "output", best[4], outlen, cells);
+        report(c->name, "convert", best[5], in->len, 0);
+        if(check && strcmp(hex, c->golden) != 0) {
+            fprintf(stderr, "%s: render digest %s, expected %s\n", c->name, hex, c->golden);
+            bad = 1;
+        }
+    }
+    free(ref);
+    free(kern);
+    noansi_buf_free(&out);
+    noansi_free(ctx);
+    return bad;
+}
+
+static void usage(void) {
+    fprintf(stderr, "args: [-gh] [-n REPS] [-s MB] [-k KERNEL] [-w DIR] [CORPUS|FILE...]\n");
+    fprintf(stderr, "      -n: runs per stage; the best one is reported (default 5)\n");
+    fprintf(stderr, "      -s: size of each input in MB (default 4); the renders are only\n");
+    fprintf(stderr, "          checked against the golden digests at the default size\n");
+    fprintf(stderr, "      -k: row kernel to use: scalar, sse2 or avx2 (default: the best\n");
+    fprintf(stderr, "          one this cpu has)\n");
+    fprintf(stderr, "      -w: write the inputs to DIR/CORPUS.ans instead of benchmarking\n");
+    fprintf(stderr, "      -g: print the digests of the renders, for the golden table\n");
+    fprintf(stderr, "      -h: show this text\n");
+    fprintf(stderr, "\n      CORPUS is any of sgr, cup, plain, tall, redraw (default: all); any\n");
+    fprintf(stderr, "      other FILE is read and timed as it is, at the default screen size\n");
+}
+
+extern int optind;
+extern char *optarg;
+int main(int argc, char *argv[]) {
+    char const *kernel = NULL, *outdir = NULL;
+    size_t size = DEFSIZE;
+    int ch, reps = 5, golden = 0, bad = 0, i;
+    unsigned int k;
+    while((ch = getopt(argc, argv, "ghn:s:k:w:")) != -1) {
+        switch(ch) {
+            case 'g':
+                golden = 1;
+                break;
+            case 'n':
+                reps = MAX(atoi(optarg), 1);
+                break;
+            case 's':
+                size = (size_t)(atof(optarg) * (1 << 20));
+                break;
+            case 'k':
+                kernel = optarg;
+                break;
+            case 'w':
+                outdir = optarg;
+                break;
+            case 'h':
+            default:
+                usage();
+                exit(0);
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    pthread_once(&xlat_once, xlat_init);
+    if(kernel != NULL) {
+        if(strcmp(kernel, "scalar") == 0) {
+            xlat_row = xlat_row_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+        } else if(strcmp(kernel, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+            xlat_row = xlat_row_sse2;
+        } else if(strcmp(kernel, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+            xlat_row = xlat_row_avx2;
+#endif
+        } else {
+            fprintf(stderr, "kernel %s isn't available\n", kernel);
+            exit(1);
+        }
+    }
+
+    if(outdir == NULL) {
+        bad |= check_kernels();
+    }
+    for(k = 0; k < NCORPORA; k++) {
+        struct noansi_buf in = { 0 };
+        for(i = 0; i < argc && strcmp(argv[i], corpora[k].name) != 0; i++)
+            ;
+        if(argc > 0 && i == argc) {
+            continue;
+        }
+        rng = SEED + k;
+        corpora[k].gen(&in, size);
+        if(outdir != NULL) {
+            char path[4096];
+            FILE *f;
+            snprintf(path, sizeof(path), "%s/%s.ans", outdir, corpora[k].name);
+            if((f = fopen(path, "wb")) == NULL || fwrite(in.data, 1, in.len, f) != in.len
+                    || fclose(f) != 0) {
+                fprintf(stderr, "%s: %s\n", path, strerror(errno));
+                exit(1);
+            }
+        } else {
+            bad |= bench(&corpora[k], &in, reps, size == DEFSIZE, golden);
+        }
+        noansi_buf_free(&in);
+    }
+    for(i = 0; outdir == NULL && i < argc; i++) {
+        struct corpus file = { argv[i], NULL, NROWS, NULL };
+        struct noansi_buf in = { 0 };
+        for(k = 0; k < NCORPORA && strcmp(argv[i], corpora[k].name) != 0; k++)
+            ;
+        if(k < NCORPORA) {
+            continue;
+        }
+        load(&in, argv[i]);
+        bad |= bench(&file, &in, reps, 0, golden);
+        noansi_buf_free(&in);
+    }
+    return bad;
+}
@@ -0,0 +1,719 @@
+#define _GNU_SOURCE     /* accept4() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+
+#include "noansi.h"
+
+/* noansid: noansi as a resident service on a unix socket, for programs that
+ * convert often enough that starting noansi for every render shows.
+ *
+ * one thread runs an epoll loop that accepts connections and reads and
+ * writes them, never blocking; whole requests go to a pool of worker
+ * threads, each with a noansi_ctx of its own that it keeps for good, so
+ * the screen, its rows and everything else a conversion needs are
+ * allocated once and reused by every request after.  a connection keeps its
+ * buffers too.
+ *
+ * a client sends any number of requests, answered in order on the same
+ * connection.  a request is a line, then the input:
+ *
+ *     render LENGTH [OPTION...]\n
+ *     <LENGTH bytes of input>
+ *
+ * the options are noansi's: t, z, m, f, u, k, p and P by themselves, and
+ * format=FORMAT, lines=START-END, rows=N, cols=N and animate=BYTES.  the
+ * answer is
+ *
+ *     ok LENGTH\n
+ *     <LENGTH bytes of output>
+ *
+ * or, if the conversion failed or the request was bad, a line
+ * "error MESSAGE\n".  a request too long or malformed to make sense of is
+ * answered that way and the connection closed, since there's no telling
+ * where the next one starts.
+ *
+ * "stats\n" is answered like a render, with a line of JSON: requests
+ * served, how many failed, and a histogram of their latencies (from having
+ * read the request to having the answer), in microseconds, by power of 2.
+ *
+ * build: cc -O2 -pthread -o noansid noansid.c libnoansi.c
+ *
+ * noansidtest.c runs a built one through what clients do that has broken
+ * it before.
+ *
+ * run noansid -h for usage
+ */
+
+#define MAXLINE 1024            /* a request line */
+#define MAXINPUT (64 << 20)     /* a request's input */
+#define READBLOCK 65536
+#define REPLYROOM 32            /* ahead of an answer, for its "ok LENGTH\n" */
+#define NBUCKETS 40             /* latency buckets: < 1us, < 2us, ... */
+#define MIN(x,y) ((x) > (y) ? (y) : (x))
+
+/* a connection.  while a worker has its request (busy), the loop leaves
+ * it alone but for writing out earlier answers: in, the request and reply
+ * are the worker's.
+ */
+struct conn {
+    int fd;
+    struct noansi_buf in;       /* read and not yet answered */
+    size_t linelen, inputlen;   /* of the request at the front of in */
+    struct noansi_buf out;      /* answers, out[sent..] not yet written */
+    size_t sent;
+    struct noansi_buf reply;    /* the worker's answer, from replyoff */
+    size_t replyoff;
+    int busy, eof, failed;
+    int gone;                   /* hung up while busy: close once answered */
+    struct timespec received;
+    struct conn *next;          /* on the queue, or the done list */
+    struct conn *prev_open, *next_open; /* on conns */
+};
+static struct conn *conns;      /* every one open, to close at the end */
+
+/* the workers, and what they've done */
+struct pool {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct conn *queue, **tail; /* requests waiting for a worker */
+    struct conn *done;          /* answered, for the loop to pick up */
+    int wakeup;                 /* eventfd the loop waits on for done */
+    noansi_cache *cache;
+    int stopping;               /* workers finish what they have and quit */
+    unsigned long requests, failed;
+    unsigned long latency[NBUCKETS];
+};
+
+static int grow(struct noansi_buf *b, size_t n) {
+    if(b->cap - b->len < n) {
+        size_t cap = b->cap ? b->cap : READBLOCK;
+        char *nd;
+        while(cap - b->len < n) {
+            cap *= 2;
+        }
+        if((nd = realloc(b->data, cap)) == NULL) {
+            return -1;
+        }
+        b->data = nd;
+        b->cap = cap;
+    }
+    return 0;
+}
+
+/* the options in a request line, after its length; NULL if fine, or else
+ * what's wrong
+ */
+static char const *parse_options(char *words, struct noansi_options *opts) {
+    char *w, *save = NULL;
+    noansi_options_init(opts);
+    for(w = strtok_r(words, " ", &save); w != NULL; w = strtok_r(NULL, " ", &save)) {
+        char *val = strchr(w, '=');
+        unsigned int a, b;
+        int i;
+        if(val != NULL) {
+            *val++ = 0;
+        }
+        if(val == NULL && strlen(w) == 1 && strchr("tzmfukpP", w[0]) != NULL) {
+            switch(w[0]) {
+                case 't': opts->expandtab = 1; break;
+                case 'z': opts->includez = 1; break;
+                case 'm': opts->minimal = 1; break;
+                case 'f': opts->frames = 1; break;
+                case 'u': opts->sauce = 1; break;
+                case 'k': opts->lenient = 1; break;
+                case 'p': opts->preview = NOANSI_PREVIEW_EXACT; break;
+                case 'P': opts->preview = NOANSI_PREVIEW_ROUGH; break;
+            }
+        } else if(val != NULL && strcmp(w, "format") == 0) {
+            char const *name;
+            for(i = 0; (name = noansi_format_name(i)) != NULL && strcmp(val, name) != 0; i++)
+                ;
+            if(name == NULL) {
+                return "unknown format";
+            }
+            opts->format = i;
+        } else if(val != NULL && strcmp(w, "lines") == 0) {
+            if(sscanf(val, "%u-%u", &a, &b) != 2) {
+                return "expected lines=START-END";
+            }
+            opts->start = a;
+            opts->end = b;
+        } else if(val != NULL && strcmp(w, "rows") == 0) {
+            opts->rows = atoi(val);
+        } else if(val != NULL && strcmp(w, "cols") == 0) {
+            opts->cols = atoi(val);
+        } else if(val != NULL && strcmp(w, "animate") == 0) {
+            opts->animate = 1;
+            opts->cadence = atoi(val);
+        } else {
+            return "unknown option";
+        }
+    }
+    return NULL;
+}
+
+static void set_error(struct conn *c, char const *msg) {
+    char line[300];
+    size_t n = snprintf(line, sizeof(line), "error %s", msg), i;
+    /* library messages end in a newline; anything in them becomes a space */
+    n = MIN(n, sizeof(line) - 1);
+    while(n > 6 && line[n-1] == '\n') {
+        n--;
+    }
+    for(i = 0; i < n; i++) {
+        if(line[i] == '\n' || line[i] == '\r') {
+            line[i] = ' ';
+        }
+    }
+    line[n++] = '\n';
+    c->reply.len = 0;
+    c->replyoff = 0;
+    if(grow(&c->reply, n) == 0) {
+        memcpy(c->reply.data, line, n);
+        c->reply.len = n;
+    }
+    c->failed = 1;
+}
+
+static double since(struct timespec const *t) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - t->tv_sec) + (now.tv_nsec - t->tv_nsec) / 1e9;
+}
+
+/* answer c's request on ctx: the output goes after REPLYROOM bytes of
+ * reply, and its header right before it
+ */
+static void handle(struct pool *p, noansi_ctx *ctx, struct conn *c) {
+    struct noansi_options opts;
+    char *line = c->in.data, *words, hdr[REPLYROOM];
+    char const *err;
+    size_t n;
+    double t;
+    unsigned int k;
+    line[c->linelen - 1] = 0;
+    /* "render LENGTH", then the options */
+    words = strchr(line + 7, ' ');
+    c->failed = 0;
+    if((err = parse_options(words != NULL ? words + 1 : line + c->linelen - 1, &opts)) != NULL) {
+        set_error(c, err);
+    } else if(noansi_set_options(ctx, &opts) != NOANSI_OK) {
+        set_error(c, noansi_error(ctx));
+    } else {
+        c->reply.len = 0;
+        if(grow(&c->reply, REPLYROOM) < 0) {
+            set_error(c, "out of memory");
+            goto done;
+        }
+        c->reply.len = REPLYROOM;
+        if(noansi_convert(ctx, c->in.data + c->linelen, c->inputlen, &c->reply) != NOANSI_OK) {
+            set_error(c, noansi_error(ctx));
+        } else {
+            n = sprintf(hdr, "ok %zu\n", c->reply.len - REPLYROOM);
+            c->replyoff = REPLYROOM - n;
+            memcpy(c->reply.data + c->replyoff, hdr, n);
+        }
+    }
+done:
+    t = since(&c->received) * 1e6;
+    for(k = 0; k < NBUCKETS - 1 && t >= (double)(1UL << k); k++)
+        ;
+    pthread_mutex_lock(&p->lock);
+    p->requests++;
+    p->failed += c->failed;
+    p->latency[k]++;
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void *worker(void *arg) {
+    struct pool *p = arg;
+    struct noansi_options opts;
+    noansi_ctx *ctx;
+    u_int64_t one = 1;
+    noansi_options_init(&opts);
+    if((ctx = noansi_new(&opts)) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    noansi_set_cache(ctx, p->cache);
+    for(;;) {
+        struct conn *c;
+        pthread_mutex_lock(&p->lock);
+        while(p->queue == NULL && !p->stopping) {
+            pthread_cond_wait(&p->cond, &p->lock);
+        }
+        if(p->stopping) {
+            pthread_mutex_unlock(&p->lock);
+            break;
+        }
+        c = p->queue;
+        if((p->queue = c->next) == NULL) {
+            p->tail = &p->queue;
+        }
+        pthread_mutex_unlock(&p->lock);
+
+        handle(p, ctx, c);
+
+        pthread_mutex_lock(&p->lock);
+        c->next = p->done;
+        p->done = c;
+        pthread_mutex_unlock(&p->lock);
+        if(write(p->wakeup, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            fprintf(stderr, "wakeup: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+    noansi_free(ctx);
+    return NULL;
+}
+
+/* the stats as a line of JSON, appended to b; -1 if out of memory */
+static int stats_json(struct pool *p, struct noansi_buf *b) {
+    unsigned long latency[NBUCKETS], requests, failed, seen, at[3] = { 0 };
+    double const pct[3] = { 0.5, 0.9, 0.99 };
+    char line[64 + NBUCKETS * 48], *s = line;
+    int k, i, first = 1, max = -1;
+    pthread_mutex_lock(&p->lock);
+    requests = p->requests;
+    failed = p->failed;
+    memcpy(latency, p->latency, sizeof(latency));
+    pthread_mutex_unlock(&p->lock);
+    /* percentiles to within their bucket: the bucket's upper bound */
+    for(k = 0, seen = 0, i = 0; k < NBUCKETS; k++) {
+        seen += latency[k];
+        while(i < 3 && requests > 0 && seen >= pct[i] * requests) {
+            at[i++] = 1UL << k;
+        }
+        if(latency[k] > 0) {
+            max = k;
+        }
+    }
+    s += sprintf(s, "{\"requests\":%lu,\"failed\":%lu,\"latency_us\":{\"p50\":%lu,"
+            "\"p90\":%lu,\"p99\":%lu,\"max\":%lu,\"histogram\":{", requests, failed,
+            at[0], at[1], at[2], max >= 0 ? 1UL << max : 0);
+    for(k = 0; k < NBUCKETS; k++) {
+        if(latency[k] > 0) {
+            s += sprintf(s, "%s\"%lu\":%lu", first ? "" : ",", 1UL << k, latency[k]);
+            first = 0;
+        }
+    }
+    s += sprintf(s, "}}}\n");
+    if(grow(b, 32 + (s - line)) < 0) {
+        return -1;
+    }
+    b->len += sprintf(b->data + b->len, "ok %zu\n", (size_t)(s - line));
+    memcpy(b->data + b->len, line, s - line);
+    b->len += s - line;
+    return 0;
+}
+
+static int epfd;
+
+static void conn_close(struct conn *c) {
+    if(c->prev_open != NULL) {
+        c->prev_open->next_open = c->next_open;
+    } else {
+        conns = c->next_open;
+    }
+    if(c->next_open != NULL) {
+        c->next_open->prev_open = c->prev_open;
+    }
+    close(c->fd);
+    free(c->in.data);
+    free(c->out.data);
+    free(c->reply.data);
+    free(c);
+}
+/* give up on c: closed now, or if a worker has it, unwatched and closed
+ * when its answer comes back (the worker, and the queue, still point to it)
+ */
+static void conn_drop(struct conn *c) {
+    if(c->busy) {
+        /* a hangup can't be unwatched, only removed */
+        epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+        c->gone = 1;
+    } else {
+        conn_close(c);
+    }
+}
+/* watch c for whatever it's waiting on: reading while there's no request
+ * out, writing while there's something to write
+ */
+static void conn_watch(struct conn *c) {
+    struct epoll_event ev;
+    ev.events = (!c->busy && !c->eof ? EPOLLIN : 0) | (c->sent < c->out.len ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+/* write what can be written without waiting; -1 if the connection's gone */
+static int conn_flush(struct conn *c) {
+    while(c->sent < c->out.len) {
+        ssize_t n = write(c->fd, c->out.data + c->sent, c->out.len - c->sent);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n < 0 && errno == EAGAIN) {
+            return 0;
+        }
+        if(n <= 0) {
+            return -1;
+        }
+        c->sent += n;
+    }
+    c->out.len = c->sent = 0;
+    return 0;
+}
+/* a request the connection can't go on from: say so, and hang up once
+ * it's been said
+ */
+static void conn_reject(struct conn *c, char const *msg) {
+    set_error(c, msg);
+    if(grow(&c->out, c->reply.len) == 0) {
+        memcpy(c->out.data + c->out.len, c->reply.data, c->reply.len);
+        c->out.len += c->reply.len;
+    }
+    c->in.len = 0;
+    c->eof = 1;
+}
+/* handle what's in c->in, as far as it goes: stats here, a render by
+ * handing it to a worker.  0, or -1 if the connection should go.
+ */
+static int conn_pump(struct pool *p, struct conn *c) {
+    while(!c->busy && c->in.len > 0) {
+        char *nl = memchr(c->in.data, '\n', MIN(c->in.len, MAXLINE));
+        unsigned long len;
+        if(nl == NULL) {
+            if(c->in.len >= MAXLINE) {
+                conn_reject(c, "request line too long");
+            }
+            break;
+        }
+        c->linelen = nl - c->in.data + 1;
+        if(c->linelen == 6 && memcmp(c->in.data, "stats\n", 6) == 0) {
+            if(stats_json(p, &c->out) < 0) {
+                return -1;
+            }
+            memmove(c->in.data, c->in.data + 6, c->in.len - 6);
+            c->in.len -= 6;
+            continue;
+        }
+        if(c->linelen < 9 || memcmp(c->in.data, "render ", 7) != 0
+                || sscanf(c->in.data + 7, "%lu", &len) != 1) {
+            conn_reject(c, "expected render LENGTH or stats");
+            break;
+        }
+        if(len > MAXINPUT) {
+            conn_reject(c, "input too large");
+            break;
+        }
+        c->inputlen = len;
+        if(c->in.len < c->linelen + c->inputlen) {
+            /* the rest of it is still to come */
+            if(grow(&c->in, c->linelen + c->inputlen - c->in.len) < 0) {
+                return -1;
+            }
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &c->received);
+        c->busy = 1;
+        c->next = NULL;
+        pthread_mutex_lock(&p->lock);
+        *p->tail = c;
+        p->tail = &c->next;
+        pthread_cond_signal(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+    }
+    return 0;
+}
+/* a worker's done with c: its answer goes out, and the request from in */
+static int conn_answered(struct pool *p, struct conn *c) {
+    size_t used = c->linelen + c->inputlen, n = c->reply.len - c->replyoff;
+    c->busy = 0;
+    if(c->out.len == 0) {
+        /* nothing ahead of it: no need to copy */
+        struct noansi_buf t = c->out;
+        c->out = c->reply;
+        c->reply = t;
+        c->sent = c->replyoff;
+    } else {
+        if(grow(&c->out, n) < 0) {
+            return -1;
+        }
+        memcpy(c->out.data + c->out.len, c->reply.data + c->replyoff, n);
+        c->out.len += n;
+    }
+    memmove(c->in.data, c->in.data + used, c->in.len - used);
+    c->in.len -= used;
+    return conn_pump(p, c);
+}
+/* read what's there without waiting; -1 if the connection should go */
+static int conn_read(struct pool *p, struct conn *c) {
+    for(;;) {
+        ssize_t n;
+        if(grow(&c->in, READBLOCK) < 0) {
+            return -1;
+        }
+        n = read(c->fd, c->in.data + c->in.len, c->in.cap - c->in.len);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n < 0 && errno == EAGAIN) {
+            break;
+        }
+        if(n < 0) {
+            return -1;
+        }
+        if(n == 0) {
+            c->eof = 1;
+            break;
+        }
+        c->in.len += n;
+        /* a request at a time: stop at one that's all here */
+        if(conn_pump(p, c) < 0) {
+            return -1;
+        }
+        if(c->busy || c->eof) {
+            return 0;
+        }
+    }
+    return conn_pump(p, c);
+}
+
+static int listen_on(char const *path, int backlog) {
+    struct sockaddr_un sun;
+    int fd;
+    if(strlen(path) >= sizeof(sun.sun_path)) {
+        fprintf(stderr, "%s: path too long\n", path);
+        return -1;
+    }
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, path);
+    if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+        fprintf(stderr, "socket: %s\n", strerror(errno));
+        return -1;
+    }
+    /* a socket left behind by an earlier run is in the way */
+    unlink(path);
+    if(bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0 || listen(fd, backlog) < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void usage(void) {
+    fprintf(stderr, "args: [-h] [-j N] [-C DIR] [-q BACKLOG] SOCKET\n");
+    fprintf(stderr, "      serve conversions on the unix socket SOCKET (see noansid.c for the\n");
+    fprintf(stderr, "      protocol) until killed\n");
+    fprintf(stderr, "      -j: use N worker threads (default: one per cpu)\n");
+    fprintf(stderr, "      -C: keep renders in (and reuse them from) the cache directory DIR\n");
+    fprintf(stderr, "      -q: connections waiting to be accepted (default 128)\n");
+    fprintf(stderr, "      -h: show this text\n");
+}
+
+#define CACHEMEM (64 << 20)     /* renders kept in memory with -C, in bytes */
+extern int optind;
+extern char *optarg;
+int main(int argc, char *argv[]) {
+    struct pool p;
+    struct epoll_event ev, evs[64];
+    struct conn listener, wakeup, signals;
+    sigset_t mask;
+    pthread_t *threads;
+    char const *cachedir = NULL, *path;
+    int ch, i, n, nthreads = sysconf(_SC_NPROCESSORS_ONLN), backlog = 128, running = 1;
+    while((ch = getopt(argc, argv, "hj:C:q:")) != -1) {
+        switch(ch) {
+            case 'j':
+                nthreads = atoi(optarg);
+                break;
+            case 'C':
+                cachedir = optarg;
+                break;
+            case 'q':
+                backlog = atoi(optarg);
+                break;
+            case 'h':
+            default:
+                usage();
+                exit(0);
+        }
+    }
+    if(optind != argc - 1) {
+        usage();
+        exit(1);
+    }
+    path = argv[optind];
+    if(nthreads < 1) {
+        nthreads = 1;
+    }
+
+    memset(&p, 0, sizeof(p));
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.cond, NULL);
+    p.tail = &p.queue;
+    if(cachedir != NULL) {
+        if(mkdir(cachedir, 0777) < 0 && errno != EEXIST) {
+            fprintf(stderr, "%s: %s\n", cachedir, strerror(errno));
+            exit(1);
+        }
+        if((p.cache = noansi_cache_new(CACHEMEM, cachedir)) == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    /* the signals that end it are read from a signalfd, in the loop; the
+     * workers inherit the mask, so they're never interrupted
+     */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    if((listener.fd = listen_on(path, backlog)) < 0) {
+        exit(1);
+    }
+    if((wakeup.fd = p.wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0
+            || (signals.fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0
+            || (epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        fprintf(stderr, "%s\n", strerror(errno));
+        exit(1);
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listener;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listener.fd, &ev);
+    ev.data.ptr = &wakeup;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, wakeup.fd, &ev);
+    ev.data.ptr = &signals;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, signals.fd, &ev);
+    if((threads = calloc(nthreads, sizeof(*threads))) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for(i = 0; i < nthreads; i++) {
+        if(pthread_create(&threads[i], NULL, worker, &p) != 0) {
+            fprintf(stderr, "couldn't start worker thread\n");
+            exit(1);
+        }
+    }
+
+    while(running) {
+        if((n = epoll_wait(epfd, evs, sizeof(evs) / sizeof(evs[0]), -1)) < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "epoll_wait: %s\n", strerror(errno));
+            exit(1);
+        }
+        for(i = 0; i < n; i++) {
+            struct conn *c = evs[i].data.ptr, *done;
+            int fd, j;
+            if(c == NULL) {
+                continue;
+            } else if(c == &signals) {
+                running = 0;
+            } else if(c == &listener) {
+                while((fd = accept4(listener.fd, NULL, NULL,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    if((c = calloc(1, sizeof(*c))) == NULL) {
+                        close(fd);
+                        continue;
+                    }
+                    c->fd = fd;
+                    if((c->next_open = conns) != NULL) {
+                        conns->prev_open = c;
+                    }
+                    conns = c;
+                    ev.events = EPOLLIN;
+                    ev.data.ptr = c;
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+                }
+            } else if(c == &wakeup) {
+                u_int64_t count;
+                if(read(wakeup.fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                    fprintf(stderr, "wakeup: %s\n", strerror(errno));
+                    exit(1);
+                }
+                pthread_mutex_lock(&p.lock);
+                done = p.done;
+                p.done = NULL;
+                pthread_mutex_unlock(&p.lock);
+                while((c = done) != NULL) {
+                    done = c->next;
+                    if(c->gone) {
+                        /* nobody to answer */
+                        c->busy = 0;
+                    } else if(conn_answered(&p, c) == 0 && conn_flush(c) == 0
+                            && !(c->eof && !c->busy && c->sent == c->out.len)) {
+                        conn_watch(c);
+                        continue;
+                    }
+                    if(!c->busy) {
+                        /* closed now, while its own event may still be
+                         * coming in this batch
+                         */
+                        for(j = i + 1; j < n; j++) {
+                            if(evs[j].data.ptr == c) {
+                                evs[j].data.ptr = NULL;
+                            }
+                        }
+                    }
+                    conn_drop(c);
+                }
+            } else if(c->gone) {
+                /* dropped earlier in this batch, waiting on its answer */
+                continue;
+            } else if(c->busy && (evs[i].events & (EPOLLHUP | EPOLLERR))) {
+                /* hung up, but a worker has it: let the answer close it */
+                conn_drop(c);
+            } else {
+                /* a busy client isn't read, and one with nothing to write
+                 * isn't watched for it
+                 */
+                if(((evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                            && !c->busy && !c->eof && conn_read(&p, c) < 0)
+                        || conn_flush(c) < 0
+                        || (c->eof && !c->busy && c->sent == c->out.len)) {
+                    /* reading may have handed its next request to a worker */
+                    conn_drop(c);
+                } else {
+                    conn_watch(c);
+                }
+            }
+        }
+    }
+    unlink(path);
+    /* the cache, and the connections, have to outlive the conversions
+     * going through them.  what's still queued is dropped: nothing would
+     * send its answer
+     */
+    pthread_mutex_lock(&p.lock);
+    p.stopping = 1;
+    pthread_cond_broadcast(&p.cond);
+    pthread_mutex_unlock(&p.lock);
+    for(i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    while(conns != NULL) {
+        conn_close(conns);
+    }
+    noansi_cache_free(p.cache);
+    return 0;
+}
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "noansi.h"
+
+/* noansidtest: a running noansid, put through what clients do to it
+ *
+ * it starts the noansid it's given on a socket of its own and, for every
+ * round, connects, sends a pipeline of renders and hangs up without
+ * reading any of the answers, which catches the daemon closing a
+ * connection a worker still has.  then it checks a render still comes back
+ * as noansi_convert() has it, and that the daemon exits cleanly when
+ * told to.  the daemon is what's under test, so build it with the
+ * sanitizers:
+ *
+ *     cc -g -O1 -fsanitize=address,undefined -pthread \
+ *         -o noansid noansid.c libnoansi.c
+ *     cc -O2 -pthread -o noansidtest noansidtest.c libnoansi.c
+ *
+ * run noansidtest -h for usage
+ */
+
+#define NPIPELINE 6     /* requests sent before hanging up */
+
+static char sockpath[64];
+static pid_t daemon_pid;
+
+static void fail(char const *what) {
+    fprintf(stderr, "%s\n", what);
+    if(daemon_pid > 0) {
+        kill(daemon_pid, SIGKILL);
+    }
+    exit(1);
+}
+/* a connection to the daemon, waiting a while for it to be listening */
+static int dial(void) {
+    struct sockaddr_un sun;
+    struct timespec pause = { 0, 10 * 1000 * 1000 };
+    int fd, tries;
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, sockpath);
+    for(tries = 0; tries < 500; tries++) {
+        if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+            fail(strerror(errno));
+        }
+        if(connect(fd, (struct sockaddr *)&sun, sizeof(sun)) == 0) {
+            return fd;
+        }
+        close(fd);
+        nanosleep(&pause, NULL);
+    }
+    fail("couldn't connect to the daemon");
+    return -1;
+}
+/* 0, or -1 if the daemon hung up (which it may once a client has) */
+static int send_all(int fd, char const *s, size_t n) {
+    while(n > 0) {
+        ssize_t w = write(fd, s, n);
+        if(w < 0 && errno == EINTR) {
+            continue;
+        }
+        if(w <= 0) {
+            return -1;
+        }
+        s += w;
+        n -= w;
+    }
+    return 0;
+}
+static void read_all(int fd, char *s, size_t n) {
+    while(n > 0) {
+        ssize_t r = read(fd, s, n);
+        if(r < 0 && errno == EINTR) {
+            continue;
+        }
+        if(r <= 0) {
+            fail("the daemon hung up on a render");
+        }
+        s += r;
+        n -= r;
+    }
+}
+/* "render LENGTH\n" and the input */
+static void put_request(struct noansi_buf *b, char const *in, size_t len) {
+    char line[32];
+    int n = snprintf(line, sizeof(line), "render %zu\n", len);
+    b->data = realloc(b->data, b->len + n + len);
+    if(b->data == NULL) {
+        fail("out of memory");
+    }
+    memcpy(b->data + b->len, line, n);
+    memcpy(b->data + b->len + n, in, len);
+    b->len += n + len;
+}
+/* some colored art, rows lines of it */
+static void make_art(struct noansi_buf *b, unsigned int rows) {
+    unsigned int x, y;
+    b->len = 0;
+    b->data = realloc(b->data, rows * 81 * 12 + 1);
+    if(b->data == NULL) {
+        fail("out of memory");
+    }
+    for(x = 0; x < rows; x++) {
+        for(y = 0; y < 80; y++) {
+            if(y % 8 == 0) {
+                b->len += sprintf(b->data + b->len, "\x1b[%u;%um", 30 + (x + y) % 8,
+                        40 + (x * 3 + y / 8) % 8);
+            }
+            b->data[b->len++] = "\xb0\xb1\xb2\xdb .:#"[(x * 7 + y) % 8];
+        }
+        b->len += sprintf(b->data + b->len, "\x1b[0m\r\n");
+    }
+}
+
+static void usage(void) {
+    fprintf(stderr, "args: [-h] [-n ROUNDS] NOANSID\n");
+    fprintf(stderr, "      -n: clients that send a pipeline and hang up (default 200)\n");
+    fprintf(stderr, "      -h: show this text\n");
+}
+
+extern int optind;
+extern char *optarg;
+int main(int argc, char *argv[]) {
+    struct noansi_buf art = { 0 }, req = { 0 }, want = { 0 };
+    struct noansi_options opts;
+    noansi_ctx *ctx;
+    char dir[] = "/tmp/noansidtest.XXXXXX", head[32], *got;
+    int ch, rounds = 200, fd, status, i;
+    size_t n;
+    while((ch = getopt(argc, argv, "hn:")) != -1) {
+        switch(ch) {
+            case 'n':
+                rounds = atoi(optarg);
+                break;
+            case 'h':
+            default:
+                usage();
+                exit(0);
+        }
+    }
+    if(optind != argc - 1) {
+        usage();
+        exit(1);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    if(mkdtemp(dir) == NULL) {
+        fail(strerror(errno));
+    }
+    snprintf(sockpath, sizeof(sockpath), "%s/sock", dir);
+    if((daemon_pid = fork()) < 0) {
+        fail(strerror(errno));
+    } else if(daemon_pid == 0) {
+        execl(argv[optind], argv[optind], "-j", "2", sockpath, (char *)NULL);
+        fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+        _exit(127);
+    }
+
+    /* pipelined, then hung up: the sizes vary so that the hangup lands at
+     * different points, answering one request and starting the next
+     */
+    for(i = 0; i < rounds; i++) {
+        int k;
+        make_art(&art, 2 + i % 4 * 20);
+        req.len = 0;
+        for(k = 0; k < NPIPELINE; k++) {
+            put_request(&req, art.data, art.len);
+        }
+        fd = dial();
+        send_all(fd, req.data, req.len);
+        close(fd);
+    }
+
+    /* and it still answers */
+    noansi_options_init(&opts);
+    if((ctx = noansi_new(&opts)) == NULL) {
+        fail("out of memory");
+    }
+    make_art(&art, 50);
+    if(noansi_convert(ctx, art.data, art.len, &want) != NOANSI_OK) {
+        fail(noansi_error(ctx));
+    }
+    req.len = 0;
+    put_request(&req, art.data, art.len);
+    fd = dial();
+    if(send_all(fd, req.data, req.len) < 0) {
+        fail("the daemon hung up on a render");
+    }
+    n = snprintf(head, sizeof(head), "ok %zu\n", want.len);
+    if((got = malloc(n + want.len)) == NULL) {
+        fail("out of memory");
+    }
+    read_all(fd, got, n + want.len);
+    if(memcmp(got, head, n) != 0 || memcmp(got + n, want.data, want.len) != 0) {
+        fail("a render came back different from noansi_convert()'s");
+    }
+    close(fd);
+
+    kill(daemon_pid, SIGTERM);
+    if(waitpid(daemon_pid, &status, 0) < 0) {
+        fail(strerror(errno));
+    }
+    daemon_pid = 0;
+    unlink(sockpath);
+    rmdir(dir);
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fail("the daemon didn't exit cleanly");
+    }
+    free(got);
+    free(art.data);
+    free(req.data);
+    noansi_buf_free(&want);
+    noansi_free(ctx);
+    printf("ok: %d pipelines hung up on\n", rounds);
+    return 0;
+}
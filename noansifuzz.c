@@ -0,0 +1,836 @@
+#include <stdint.h>
+
+/* small enough that a preview looks at the rest of even short inputs, and
+ * that they're cut at their clears and parsed in parallel
+ */
+#define PREVIEWBLOCK 16
+#define PARMIN 16
+#include "libnoansi.c"
+
+/* noansifuzz: the parser on arbitrary bytes, checked against a reference
+ *
+ * every input goes through the parser fed in pieces, and through a reference
+ * terminal written as plainly as it can be: a whole grid, erases that really
+ * erase, a switch per byte.  the two have to end up with the same screen,
+ * cursor, colors and counts.  then it's converted the way its header says
+ * (any format, frames, animation or streaming), for the sanitizers to watch,
+ * with a couple of checks that need no reference: frames come out the same
+ * parsed by 1 thread or 3, an input cut at its clears and parsed in 3 threads
+ * the same as in one go, a cache hit the same as a miss, and an exact preview
+ * the same as the whole.  a difference is an abort(), which is what fuzzers
+ * look for.
+ *
+ * the first HDRLEN bytes of an input are its options (see fuzz_one()); the
+ * rest is the picture.  short inputs are padded with zeroes.
+ *
+ * this includes libnoansi.c itself, to get at the screen, so it's built
+ * alone.  for libFuzzer:
+ *
+ *     clang -g -O1 -fsanitize=fuzzer,address,undefined -DLIBFUZZER -pthread \
+ *         -o noansifuzz noansifuzz.c
+ *
+ * for AFL (afl-fuzz ... -- ./noansifuzz @@), or to replay crashes or run
+ * generated inputs:
+ *
+ *     cc -g -O1 -fsanitize=address,undefined -fno-sanitize-recover=all -pthread \
+ *         -o noansifuzz noansifuzz.c
+ *
+ * run noansifuzz -h for usage
+ */
+
+/* the reference.  rows end at their last cell that isn't default_char, as
+ * the screen's lens do, and the screen ends at its last row with anything
+ * on it.
+ */
+struct ref {
+    achar_t *grid;
+    unsigned int nrows, ncols;
+    unsigned int x, y, savedx, savedy, saved;
+    unsigned int fg, bg, flags;
+    unsigned int state, seqlen;
+    int params[MAXSEQLEN], np, num, ndigits, ques, semis;
+    unsigned long cells, skips[NOANSI_NSKIPS], seqs[NOANSI_NFINALS];
+};
+static void ref_erase(struct ref *r, unsigned int x, unsigned int from, unsigned int to) {
+    unsigned int y;
+    for(y = from; y < MIN(to, r->ncols); y++) {
+        r->grid[x * r->ncols + y] = default_char;
+    }
+}
+static unsigned int ref_len(struct ref const *r, unsigned int x) {
+    unsigned int n = r->ncols;
+    while(n > 0 && r->grid[x * r->ncols + n - 1] == default_char) {
+        n--;
+    }
+    return n;
+}
+static unsigned int clamp(int v, unsigned int n) {
+    return v < 0 ? 0 : v > (int)n - 1 ? n - 1 : (unsigned int)v;
+}
+/* a sequence we can't handle: -1 strict; counted and skipped lenient */
+static int ref_bad(struct ref *r, struct noansi_options const *o, int kind,
+        unsigned int then) {
+    if(!o->lenient) {
+        return -1;
+    }
+    r->skips[kind]++;
+    r->state = then;
+    return 0;
+}
+/* the final byte c of a CSI sequence */
+static int ref_seq(struct ref *r, struct noansi_options const *o, unsigned int c) {
+    int const p0 = r->np > 0 ? r->params[0] : -1, form = NOANSI_SKIP_FORM;
+    unsigned int d, i;
+    switch(c) {
+        case 'm':
+            if(r->ques) {
+                return ref_bad(r, o, form, SKIPREST(c));
+            }
+            if(r->np == 0) {
+                handle_sgr(0, &r->fg, &r->bg, &r->flags);
+            }
+            for(i = 0; i < (unsigned int)r->np; i++) {
+                if(handle_sgr(r->params[i], &r->fg, &r->bg, &r->flags) < 0) {
+                    r->skips[NOANSI_SKIP_SGR]++;
+                }
+            }
+            break;
+        case 'J':
+            if(r->ques || r->np > 1 || p0 > 3) {
+                return ref_bad(r, o, form, SKIPREST(c));
+            }
+            if(p0 <= 0) {
+                ref_erase(r, r->x, r->y, r->ncols);
+                for(i = r->x + 1; i < r->nrows; i++) {
+                    ref_erase(r, i, 0, r->ncols);
+                }
+            } else if(p0 == 1) {
+                for(i = 0; i < r->x; i++) {
+                    ref_erase(r, i, 0, r->ncols);
+                }
+                ref_erase(r, r->x, 0, r->y + 1);
+            } else if(p0 == 2) {
+                for(i = 0; i < r->nrows; i++) {
+                    ref_erase(r, i, 0, r->ncols);
+                }
+                r->x = r->y = 0;
+            }
+            break;
+        case 'h':
+            /* CSI ? 7 h: wrapping, which is always on anyway */
+            if(!r->ques || r->np != 1 || p0 != 7) {
+                return ref_bad(r, o, form, SKIPREST(c));
+            }
+            break;
+        case 'H':
+        case 'f':
+            if(r->ques) {
+                return ref_bad(r, o, form, SKIPREST(c));
+            }
+            if(r->np == 0) {
+                r->x = r->y = 0;
+            } else if(r->np == 1 && r->semis == 0) {
+                r->x = clamp(p0 - 1, r->nrows);
+                r->y = 0;
+            } else if(r->np == 1) {
+                r->x = 0;
+                r->y = clamp(p0 - 1, r->ncols);
+            } else if(r->np == 2) {
+                r->x = clamp(p0 - 1, r->nrows);
+                r->y = clamp(r->params[1] - 1, r->ncols);
+            }
+            break;
+        case 's':
+            if(r->ques || r->np != 0) {
+                return ref_bad(r, o, form, SKIPREST(c));
+            }
+            r->savedx = r->x;
+            r->savedy = r->y;
+            r->saved = 1;
+            break;
+        case 'u':
+            if(r->ques || r->np != 0) {
+                return ref_bad(r, o, form, SKIPREST(c));
+            }
+            if(!r->saved) {
+                return ref_bad(r, o, NOANSI_SKIP_RESTORE, S_GROUND);
+            }
+            r->x = r->savedx;
+            r->y = r->savedy;
+            break;
+        case 'K':
+            if(r->ques || r->np > 1 || p0 > 2) {
+                return ref_bad(r, o, form, SKIPREST(c));
+            }
+            if(p0 <= 0) {
+                ref_erase(r, r->x, r->y, r->ncols);
+            } else {
+                ref_erase(r, r->x, 0, p0 == 1 ? r->y + 1 : r->ncols);
+            }
+            break;
+        case 'G':
+        case 'd':
+            if(r->ques || r->np > 1) {
+                return ref_bad(r, o, form, SKIPREST(c));
+            }
+            if(c == 'G') {
+                r->y = clamp((r->np ? p0 : 1) - 1, r->ncols);
+            } else {
+                r->x = clamp((r->np ? p0 : 1) - 1, r->nrows);
+            }
+            break;
+        case 'A':
+        case 'B':
+        case 'C':
+        case 'D':
+            if(r->ques || r->np > 1) {
+                return ref_bad(r, o, form, SKIPREST(c));
+            }
+            d = r->np ? (unsigned int)p0 : 1;
+            if(c == 'A') {
+                r->x = d > r->x ? 0 : r->x - d;
+            } else if(c == 'B') {
+                r->x = MIN(r->nrows - 1, r->x + d);
+            } else if(c == 'C') {
+                r->y = MIN(r->ncols - 1, r->y + d);
+            } else {
+                r->y = d > r->y ? 0 : r->y - d;
+            }
+            break;
+        default:
+            return ref_bad(r, o, NOANSI_SKIP_UNKNOWN, SKIPREST(c));
+    }
+    r->state = S_GROUND;
+    return 0;
+}
+/* one byte: 0 to go on, 1 at the end of the picture, -1 on an error */
+static int ref_byte(struct ref *r, struct noansi_options const *o, unsigned int c) {
+    switch(r->state) {
+        case S_STOP:
+            return 1;
+        case S_IGNORE:
+            if(c == 0x1a && !o->includez) {
+                r->state = S_STOP;
+                return 1;
+            }
+            if(ISFINAL(c)) {
+                r->state = S_GROUND;
+            }
+            return 0;
+        case S_ESCAPE:
+            if(c != '[') {
+                return ref_bad(r, o, NOANSI_SKIP_ESCAPE, S_GROUND);
+            }
+            r->state = S_CSI;
+            r->np = r->num = r->ndigits = r->ques = r->semis = 0;
+            r->seqlen = 0;
+            return 0;
+        case S_CSI:
+            if(++r->seqlen == MAXSEQLEN) {
+                return ref_bad(r, o, NOANSI_SKIP_LENGTH, SKIPREST(c));
+            }
+            if(c == 0x1a && !o->includez) {
+                r->state = S_STOP;
+                return 1;
+            }
+            if(c >= '0' && c <= '9') {
+                if(r->ndigits == 4) {
+                    return ref_bad(r, o, NOANSI_SKIP_NUMBER, S_IGNORE);
+                }
+                r->num = r->num * 10 + (c - '0');
+                r->ndigits++;
+                return 0;
+            }
+            if(r->ndigits > 0) {
+                r->params[r->np++] = r->num;
+                r->num = r->ndigits = 0;
+            }
+            if(ISFINAL(c)) {
+                r->seqs[c - 0x40]++;
+            }
+            if(c == '?') {
+                if(r->np != 0) {
+                    return ref_bad(r, o, NOANSI_SKIP_FORM, SKIPREST(c));
+                }
+                r->ques = 1;
+                return 0;
+            }
+            if(c == ';') {
+                r->semis++;
+                return 0;
+            }
+            return ref_seq(r, o, c);
+    }
+    /* S_GROUND */
+    switch(c) {
+        case '\t':
+            if(o->expandtab) {
+                r->y = MIN(r->ncols - 1, (r->y + 8) & ~7u);
+                return 0;
+            }
+            break;
+        case '\n':
+            r->x = MIN(r->nrows - 1, r->x + 1);
+            r->y = 0;
+            return 0;
+        case '\r':
+            r->y = 0;
+            return 0;
+        case 0x1a:
+            if(!o->includez) {
+                r->state = S_STOP;
+                return 1;
+            }
+            break;
+        case 0x1b:
+            r->state = S_ESCAPE;
+            return 0;
+    }
+    r->grid[r->x * r->ncols + r->y] = AC(c, r->fg, r->bg, r->flags);
+    r->cells++;
+    if(++r->y == r->ncols) {
+        r->y = 0;
+        r->x = MIN(r->nrows - 1, r->x + 1);
+    }
+    return 0;
+}
+/* the whole input; NOANSI_OK or NOANSI_ESYNTAX */
+static int ref_run(struct ref *r, struct noansi_options const *o, unsigned char const *in,
+        size_t len) {
+    size_t i;
+    int rc = 0;
+    memset(r, 0, sizeof(*r));
+    r->nrows = o->rows;
+    r->ncols = o->cols;
+    r->fg = aWHITE;
+    r->bg = aBLACK;
+    r->state = S_GROUND;
+    if((r->grid = malloc((size_t)r->nrows * r->ncols * sizeof(achar_t))) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    fill_blank(r->grid, r->nrows * r->ncols);
+    for(i = 0; i < len && rc == 0; i++) {
+        rc = ref_byte(r, o, in[i]);
+    }
+    if(rc == 0 && r->state == S_ESCAPE) {
+        rc = ref_bad(r, o, NOANSI_SKIP_EOF, S_ESCAPE);
+    }
+    return rc < 0 ? NOANSI_ESYNTAX : NOANSI_OK;
+}
+
+/* what's different between the parser and the reference, or NULL */
+static char why[256];
+static char const *ref_diff(noansi_ctx const *ctx, int rc, struct ref const *r, int refrc) {
+    struct screen const *s = &ctx->screen;
+    struct parser const *ps = &ctx->ps;
+    unsigned int x, y, used = 0;
+    if(rc != refrc) {
+        snprintf(why, sizeof(why), "returned %d, reference %d", rc, refrc);
+        return why;
+    }
+    if(ps->x != r->x || ps->y != r->y) {
+        snprintf(why, sizeof(why), "cursor at %u,%u, reference %u,%u", ps->x, ps->y, r->x, r->y);
+        return why;
+    }
+    if(ps->saved != r->saved || (r->saved && (ps->savedx != r->savedx
+                    || ps->savedy != r->savedy))) {
+        snprintf(why, sizeof(why), "saved position differs");
+        return why;
+    }
+    if(ps->curfg != r->fg || ps->curbg != r->bg || ps->curflags != r->flags) {
+        snprintf(why, sizeof(why), "colors %u/%u/%x, reference %u/%u/%x", ps->curfg,
+                ps->curbg, ps->curflags, r->fg, r->bg, r->flags);
+        return why;
+    }
+    for(x = 0; x < r->nrows; x++) {
+        achar_t const *row = screen_peek(s, x);
+        unsigned int len = row != NULL ? s->lens[x] : 0, rlen = ref_len(r, x);
+        if(len != rlen) {
+            snprintf(why, sizeof(why), "row %u is %u long, reference %u", x, len, rlen);
+            return why;
+        }
+        for(y = 0; y < len; y++) {
+            if(row[y] != r->grid[x * r->ncols + y]) {
+                snprintf(why, sizeof(why), "cell %u,%u is %x, reference %x", x, y, row[y],
+                        r->grid[x * r->ncols + y]);
+                return why;
+            }
+        }
+        used = len > 0 ? x + 1 : used;
+    }
+    if(s->used != used) {
+        snprintf(why, sizeof(why), "%u rows used, reference %u", s->used, used);
+        return why;
+    }
+    if(ctx->counts.cells != r->cells
+            || memcmp(ctx->counts.skips, r->skips, sizeof(r->skips)) != 0
+            || memcmp(ctx->counts.seqs, r->seqs, sizeof(r->seqs)) != 0) {
+        snprintf(why, sizeof(why), "counts differ");
+        return why;
+    }
+    return NULL;
+}
+
+/* the header: what to do with the rest of the input */
+#define HDRLEN 5
+enum { M_CONVERT, M_FRAMES, M_ANIMATE, M_STREAM };
+static int same(struct noansi_buf const *a, struct noansi_buf const *b) {
+    return a->len == b->len && (a->len == 0 || memcmp(a->data, b->data, a->len) == 0);
+}
+/* frames, parsed in 3 threads or 1: the same */
+static char const *check_frames(noansi_ctx *ctx, struct noansi_options *opts,
+        unsigned char const *in, size_t len) {
+    struct noansi_buf a = { 0 }, b = { 0 };
+    char const *bad = NULL;
+    int rca, rcb;
+    opts->threads = 3;
+    noansi_set_options(ctx, opts);
+    rca = noansi_convert(ctx, in, len, &a);
+    opts->threads = 1;
+    noansi_set_options(ctx, opts);
+    rcb = noansi_convert(ctx, in, len, &b);
+    if(rca != rcb || (rca == NOANSI_OK && !same(&a, &b))) {
+        bad = "frames differ parsed in 3 threads";
+    }
+    noansi_buf_free(&a);
+    noansi_buf_free(&b);
+    return bad;
+}
+/* cut at its clears and parsed in 3 threads, and in one thread, which is
+ * render() and never cuts: the same, skips and all
+ */
+static char const *check_split(noansi_ctx *ctx, struct noansi_options const *opts,
+        unsigned char const *in, size_t len) {
+    struct noansi_options o = *opts;
+    struct noansi_buf a = { 0 }, b = { 0 };
+    unsigned long skips[NOANSI_NSKIPS];
+    char const *bad = NULL;
+    int rca, rcb;
+    o.frames = o.animate = 0;
+    o.threads = 3;
+    noansi_set_options(ctx, &o);
+    rca = noansi_convert(ctx, in, len, &a);
+    memcpy(skips, noansi_skipped(ctx), sizeof(skips));
+    o.threads = 1;
+    noansi_set_options(ctx, &o);
+    rcb = noansi_convert(ctx, in, len, &b);
+    if(rca != rcb || (rca == NOANSI_OK && !same(&a, &b))) {
+        bad = "cut at its clears, it differs from in one go";
+    } else if(memcmp(skips, noansi_skipped(ctx), sizeof(skips)) != 0) {
+        bad = "cut at its clears, it skips differently";
+    }
+    noansi_set_options(ctx, opts);
+    noansi_buf_free(&a);
+    noansi_buf_free(&b);
+    return bad;
+}
+/* converted through a cache, missing and then hitting, and without: the same,
+ * and with the same counts of what was skipped
+ */
+static char const *check_cache(noansi_ctx *ctx, unsigned char const *in, size_t len) {
+    struct noansi_buf out[3] = { { 0 } };
+    unsigned long skips[3][NOANSI_NSKIPS];
+    noansi_cache *cache = noansi_cache_new(1 << 20, NULL);
+    char const *bad = NULL;
+    int rc[3], i;
+    if(cache == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for(i = 0; i < 3; i++) {
+        noansi_set_cache(ctx, i > 0 ? cache : NULL);
+        rc[i] = noansi_convert(ctx, in, len, &out[i]);
+        memcpy(skips[i], noansi_skipped(ctx), sizeof(skips[i]));
+    }
+    noansi_set_cache(ctx, NULL);
+    for(i = 1; i < 3; i++) {
+        if(rc[i] != rc[0] || (rc[0] == NOANSI_OK && (!same(&out[i], &out[0])
+                        || memcmp(skips[i], skips[0], sizeof(skips[0])) != 0))) {
+            bad = i == 1 ? "a cache miss differs" : "a cache hit differs";
+        }
+    }
+    for(i = 0; i < 3; i++) {
+        noansi_buf_free(&out[i]);
+    }
+    noansi_cache_free(cache);
+    return bad;
+}
+/* an exact preview, stopped as soon as nothing after could matter, and the
+ * whole input: the same.  a rough one only has to be safe.  the lines asked
+ * for, and then the top 1, 2 and 4, where it stops far more often
+ */
+static char const *check_preview(noansi_ctx *ctx, struct noansi_options const *opts,
+        unsigned char const *in, size_t len) {
+    struct noansi_options o = *opts;
+    struct noansi_buf a = { 0 }, b = { 0 };
+    char const *bad = NULL;
+    unsigned int i;
+    int rca, rcb;
+    for(i = 0; i < 4 && bad == NULL; i++) {
+        if(i > 0) {
+            o.start = 0;
+            o.end = 1 << (i - 1);
+        }
+        o.preview = NOANSI_PREVIEW_OFF;
+        noansi_set_options(ctx, &o);
+        a.len = b.len = 0;
+        rca = noansi_convert(ctx, in, len, &a);
+        o.preview = NOANSI_PREVIEW_EXACT;
+        noansi_set_options(ctx, &o);
+        rcb = noansi_convert(ctx, in, len, &b);
+        if(rca != rcb || (rca == NOANSI_OK && !same(&a, &b))) {
+            bad = "an exact preview differs";
+        }
+        o.preview = NOANSI_PREVIEW_ROUGH;
+        noansi_set_options(ctx, &o);
+        noansi_convert(ctx, in, len, &b);
+    }
+    noansi_set_options(ctx, opts);
+    noansi_buf_free(&a);
+    noansi_buf_free(&b);
+    return bad;
+}
+static void stream(noansi_ctx *ctx, unsigned char const *in, size_t len, size_t piece) {
+    struct noansi_buf out = { 0 };
+    size_t i;
+    int rc = noansi_stream_begin(ctx);
+    for(i = 0; i < len && rc == NOANSI_OK; i += piece) {
+        rc = noansi_stream_feed(ctx, in + i, MIN(piece, len - i), &out);
+    }
+    if(rc == NOANSI_OK) {
+        noansi_stream_end(ctx, &out);
+    }
+    noansi_buf_free(&out);
+}
+/* one input, laid out as
+ *   0: flags: 1 expand tabs, 2 past ^Z, 4 lenient, 8 minimal, 16 SAUCE
+ *   1: the format (bits 0-2), the mode (3-4) and the size of the pieces
+ *      the parser is fed, 1 << bits 5-7 bytes, or all at once for 7
+ *   2: screen height, 1 + 3 * this, to get past row 255
+ *   3: screen width, 1 + this % 132
+ *   4: lines start (bits 0-3) and end, 4 lines a step of bits 4-7 past
+ *      start, or all of them for 15; the window and cadence come from it
+ *      too
+ * and returns what went wrong, or NULL
+ */
+static char const *fuzz_one(unsigned char const *data, size_t size) {
+    unsigned char h[HDRLEN] = { 0 };
+    unsigned char const *in = data + MIN(size, HDRLEN);
+    size_t const len = size - MIN(size, HDRLEN);
+    struct noansi_options opts;
+    struct ref r;
+    noansi_ctx *ctx;
+    char const *bad;
+    size_t piece, i;
+    int rc, refrc;
+    memcpy(h, data, MIN(size, HDRLEN));
+    noansi_options_init(&opts);
+    opts.expandtab = !!(h[0] & 1);
+    opts.includez = !!(h[0] & 2);
+    opts.lenient = !!(h[0] & 4);
+    opts.minimal = !!(h[0] & 8);
+    opts.sauce = !!(h[0] & 16);
+    opts.format = (h[1] & 7) % NFORMATS;
+    opts.rows = 1 + 3 * h[2];
+    opts.cols = 1 + h[3] % 132;
+    opts.start = h[4] & 15;
+    opts.end = h[4] >> 4 == 15 ? UINT_MAX : opts.start + 4 * (h[4] >> 4);
+    opts.window = h[4] & 31;
+    piece = h[1] >> 5 == 7 ? MAX(len, 1) : (size_t)1 << (h[1] >> 5);
+    if((ctx = noansi_new(&opts)) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    /* the parser, picking up where it left off at every piece */
+    reset(ctx);
+    for(i = 0, rc = NOANSI_OK; i < len && rc == NOANSI_OK; i += piece) {
+        rc = read_ansi(ctx, in + i, MIN(piece, len - i));
+    }
+    if(rc == NOANSI_OK) {
+        rc = read_ansi_end(ctx);
+    }
+    refrc = ref_run(&r, &opts, in, len);
+    bad = ref_diff(ctx, rc, &r, refrc);
+    free(r.grid);
+
+    if(bad == NULL) {
+        switch((h[1] >> 3) & 3) {
+            case M_CONVERT:
+                if((bad = check_cache(ctx, in, len)) == NULL) {
+                    bad = check_preview(ctx, &opts, in, len);
+                }
+                break;
+            case M_FRAMES:
+                if((bad = check_split(ctx, &opts, in, len)) == NULL) {
+                    opts.frames = 1;
+                    bad = check_frames(ctx, &opts, in, len);
+                }
+                break;
+            case M_ANIMATE:
+                opts.animate = 1;
+                opts.cadence = 64 * (h[4] >> 4);
+                noansi_set_options(ctx, &opts);
+                bad = check_cache(ctx, in, len);
+                break;
+            case M_STREAM:
+                stream(ctx, in, len, piece);
+                break;
+        }
+    }
+    noansi_free(ctx);
+    return bad;
+}
+
+#ifdef LIBFUZZER
+int LLVMFuzzerTestOneInput(uint8_t const *data, size_t size) {
+    char const *bad = fuzz_one(data, size);
+    if(bad != NULL) {
+        fprintf(stderr, "noansifuzz: %s\n", bad);
+        abort();
+    }
+    return 0;
+}
+#else
+
+/* generated inputs: random headers and pictures made of the things the
+ * parser cares about, more of them broken than real art would have.
+ * strict, SGR codes are only ones the parser knows, or every input would
+ * warn about them.
+ */
+static u_int64_t rng;
+static unsigned int rnd(unsigned int n) {
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return (unsigned int)((rng * 0x2545f4914f6cdd1dULL) >> 32) % n;
+}
+static void put(struct noansi_buf *b, char const *s, size_t n) {
+    if(buf_reserve(b, n) < 0) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+}
+static void putch(struct noansi_buf *b, unsigned char c) {
+    put(b, (char const *)&c, 1);
+}
+static void put_param(struct noansi_buf *b, int sgr) {
+    static const int codes[] = { 0, 1, 4, 5, 7, 8, 30, 31, 33, 35, 37, 39, 40, 42,
+        44, 46, 47, 48, 49, 53, 55 };
+    static const int nums[] = { 0, 1, 2, 3, 7, 8, 25, 80, 81, 254, 255, 256, 257,
+        300, 1000, 9999, 12345 };
+    char s[16];
+    int n = sgr ? codes[rnd(sizeof(codes) / sizeof(codes[0]))]
+        : nums[rnd(sizeof(nums) / sizeof(nums[0]))];
+    put(b, s, snprintf(s, sizeof(s), "%d", n));
+}
+static void put_seq(struct noansi_buf *b, int lenient) {
+    static const char finals[] = "mmmmHHfJJKKsuuABCDGdh";
+    unsigned int final = rnd(8) ? (unsigned char)finals[rnd(sizeof(finals) - 1)]
+        : 0x20 + rnd(0x5f);
+    unsigned int i, n = rnd(4);
+    if(final == 'm' && !lenient) {
+        final = 'H';
+    }
+    put(b, "\x1b[", 2);
+    if(rnd(10) == 0) {
+        putch(b, '?');
+    }
+    for(i = 0; i < n; i++) {
+        if(i > 0 || rnd(10) == 0) {
+            putch(b, ';');
+        }
+        if(rnd(10) != 0) {
+            put_param(b, final == 'm' && (!lenient || rnd(4) != 0));
+        }
+    }
+    putch(b, final);
+}
+static void gen(struct noansi_buf *b) {
+    unsigned int i, j, k, n = rnd(200);
+    int lenient;
+    for(i = 0; i < HDRLEN; i++) {
+        putch(b, rnd(256));
+    }
+    /* mostly small screens, where the edges are */
+    b->data[2] = rnd(4) ? rnd(16) : rnd(256);
+    b->data[3] = rnd(4) ? rnd(40) : rnd(256);
+    lenient = b->data[0] & 4;
+    for(i = 0; i < n; i++) {
+        switch(rnd(12)) {
+            case 0: case 1: case 2: case 3:
+                for(j = 0, k = 1 + rnd(20); j < k; j++) {
+                    putch(b, rnd(8) ? 0x20 + rnd(0xe0) : rnd(0x20));
+                }
+                break;
+            case 4:
+                put(b, "\r\n\n\t\r", 1 + rnd(3));
+                break;
+            case 5: case 6: case 7: case 8: case 9:
+                put_seq(b, lenient);
+                break;
+            case 10:
+                put(b, "\x1b[2J", 4);
+                break;
+            case 11:
+                switch(rnd(4)) {
+                    case 0:
+                        putch(b, 0x1b);
+                        putch(b, rnd(256));
+                        break;
+                    case 1:
+                        putch(b, 0x1a);
+                        break;
+                    case 2:
+                        put(b, "\x1b[123456789;", 12);
+                        break;
+                    case 3:
+                        putch(b, 0x1b);
+                        break;
+                }
+                break;
+        }
+    }
+}
+
+/* which input a sanitizer found something in */
+#ifndef __has_feature
+#define __has_feature(x) 0
+#endif
+#if defined(__SANITIZE_ADDRESS__) || __has_feature(address_sanitizer)
+#include <sanitizer/common_interface_defs.h>
+#define SANITIZED
+#endif
+/* inputs that once went wrong, checked before the generated ones.  lenient
+ * frames of 80x25, all lines
+ */
+#define R(s) { s, sizeof(s) - 1 }
+static struct {
+    char const *data;
+    size_t len;
+} const regressions[] = {
+    /* a bad CSI takes the ESC of the CSI 2 J after it, which is no cut */
+    R("\x04\xe8\x08\x4f\xf0" "\x1b[2Jfirst\r\n" "\x1b[" "\x1b[2Jlast\r\n"),
+    /* ESC ^Z is a bad escape, and parsing goes on past the ^Z */
+    R("\x04\xe8\x08\x4f\xf0" "zero\r\n" "\x1b[2Jone\r\n" "\x1b\x1a" "\x1b[2Jtwo\r\n"),
+};
+#undef R
+static u_int64_t seed = 1;
+static long current = -1;
+static void say_which(void) {
+    if(current >= 0) {
+        fprintf(stderr, "noansifuzz: that was input %ld of seed %llu\n", current,
+                (unsigned long long)seed);
+    }
+}
+
+static int run_file(char const *path) {
+    struct noansi_buf in = { 0 };
+    FILE *f = path != NULL ? fopen(path, "rb") : stdin;
+    char const *bad;
+    size_t n;
+    if(f == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    do {
+        if(buf_reserve(&in, OBUFSZ) < 0) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        n = fread(in.data + in.len, 1, OBUFSZ, f);
+        in.len += n;
+    } while(n > 0);
+    if(path != NULL) {
+        fclose(f);
+    }
+    if((bad = fuzz_one((unsigned char const *)in.data, in.len)) != NULL) {
+        fprintf(stderr, "%s: %s\n", path != NULL ? path : "stdin", bad);
+        abort();
+    }
+    noansi_buf_free(&in);
+    return 0;
+}
+
+static void usage(void) {
+    fprintf(stderr, "args: [-h] [-n COUNT] [-s SEED] [-w INDEX] [FILE...]\n");
+    fprintf(stderr, "      -n: generate COUNT inputs and check each, after the regressions\n");
+    fprintf(stderr, "      -s: seed for -n and -w (default 1)\n");
+    fprintf(stderr, "      -w: write generated input INDEX to stdout instead, to\n");
+    fprintf(stderr, "          replay the one -n stopped at\n");
+    fprintf(stderr, "      -h: show this text\n");
+    fprintf(stderr, "\n      without -n or -w, check each FILE, or stdin if there are none\n");
+}
+
+extern int optind;
+extern char *optarg;
+int main(int argc, char *argv[]) {
+    long count = -1, which = -1, i;
+    int ch, bad = 0;
+    while((ch = getopt(argc, argv, "hn:s:w:")) != -1) {
+        switch(ch) {
+            case 'n':
+                count = atol(optarg);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'w':
+                which = atol(optarg);
+                break;
+            case 'h':
+            default:
+                usage();
+                exit(0);
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    if(count < 0 && which < 0) {
+        if(argc == 0) {
+            return run_file(NULL);
+        }
+        for(i = 0; i < argc; i++) {
+            bad |= run_file(argv[i]);
+        }
+        return bad;
+    }
+#ifdef SANITIZED
+    __sanitizer_set_death_callback(say_which);
+#endif
+    for(i = 0; which < 0 && i < (long)(sizeof(regressions) / sizeof(regressions[0])); i++) {
+        char const *what = fuzz_one((unsigned char const *)regressions[i].data,
+                regressions[i].len);
+        if(what != NULL) {
+            fprintf(stderr, "noansifuzz: %s, in regression %ld\n", what, i);
+            exit(1);
+        }
+    }
+    for(i = which >= 0 ? which : 0; i < (which >= 0 ? which + 1 : count); i++) {
+        struct noansi_buf in = { 0 };
+        char const *what;
+        /* each input from its own seed, so any one can be made again alone */
+        rng = (seed + (u_int64_t)i) * 0x9e3779b97f4a7c15ULL | 1;
+        gen(&in);
+        if(which >= 0) {
+            fwrite(in.data, 1, in.len, stdout);
+        } else {
+            current = i;
+            if((what = fuzz_one((unsigned char const *)in.data, in.len)) != NULL) {
+                fprintf(stderr, "noansifuzz: %s\n", what);
+                say_which();
+                exit(1);
+            }
+        }
+        noansi_buf_free(&in);
+    }
+    if(which < 0) {
+        printf("%ld inputs, no differences\n", count);
+    }
+    return 0;
+}
+#endif